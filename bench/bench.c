@@ -0,0 +1,216 @@
+/* Benchmarks for the shell loop. Drives getCommand, parseCommand and routeCommand directly, times
+ * every operation on its own, and reports the median and 99th percentile so one slow run doesn't
+ * move the numbers. Heap allocations per operation come from heapAllocations; the steady-state
+ * cases should show none.
+ * build and run: make bench
+ */
+#define MSHELL_NO_MAIN
+#include "../mshell.c"
+
+#define SAMPLES 2000
+#define WARMUP 50
+#define LINE_LENGTH 2048
+
+int resultFd;				//the real stdout; the shell's own output goes to /dev/null.
+long samples[SAMPLES];
+
+int compareLong(const void* a, const void* b) {
+	long x = *(const long*)a, y = *(const long*)b;
+	return (x > y) - (x < y);
+}
+
+void report(const char* name, int count, unsigned long allocs) {
+	qsort(samples,count,sizeof(long),compareLong);
+	double median = samples[count / 2] / 1000.0;
+	double p99 = samples[count * 99 / 100] / 1000.0;
+	dprintf(resultFd,"%-28s median %10.2f us   p99 %10.2f us   %10.0f ops/s   allocs/op %.2f\n",
+			name,median,p99,1e6 / median,(double)allocs / count);
+}
+
+//Repeat a pattern as many whole times as fit in LINE_LENGTH characters, then pad with spaces.
+void fillLine(char* line, const char* pattern) {
+	size_t len = strlen(pattern);
+	size_t i = 0;
+	for(; i + len <= LINE_LENGTH; i += len) {
+		memcpy(line + i,pattern,len);
+	}
+	memset(line + i,' ',LINE_LENGTH - i);
+	line[LINE_LENGTH] = '\0';
+}
+
+//Parse only, from a fresh arena each time like the shell loop.
+void benchParse(const char* name, const char* line) {
+	unsigned long allocs = 0;
+	for(int i=-WARMUP; i<SAMPLES; i++) {
+		struct timespec start;
+		unsigned long before = heapAllocations;
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		struct Command* cmnd = newCommand();
+		cmnd->rawCommand = (char*)line;
+		parseCommand(cmnd);
+		arenaReset();
+		if(i >= 0) {
+			samples[i] = nanosSince(&start);
+			allocs += heapAllocations - before;
+		}
+	}
+	report(name,SAMPLES,allocs);
+}
+
+//getCommand over a file of lines, the batch mode input path.
+void benchRead() {
+	char path[] = "/tmp/mshell-bench-XXXXXX";
+	int fd = mkstemp(path);
+	FILE* script = fdopen(fd,"w");
+	for(int i=0; i<SAMPLES + WARMUP; i++) {
+		fprintf(script,"echo line %d with a few words on it > /dev/null\n",i);
+	}
+	fclose(script);
+	inputFd = open(path,O_RDONLY|O_CLOEXEC);
+	unlink(path);
+	unsigned long allocs = 0;
+	for(int i=-WARMUP; i<SAMPLES; i++) {
+		struct timespec start;
+		unsigned long before = heapAllocations;
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		struct Command* cmnd = newCommand();
+		getCommand(cmnd);
+		arenaReset();
+		if(i >= 0) {
+			samples[i] = nanosSince(&start);
+			allocs += heapAllocations - before;
+		}
+	}
+	close(inputFd);
+	inputFd = -1;
+	report("getCommand (batch)",SAMPLES,allocs);
+}
+
+//Parse and route one line, the whole loop minus reading it. Used for foreground commands and builtins.
+void benchRoute(const char* name, const char* line, int count) {
+	int exitStatus = 0;
+	unsigned long allocs = 0;
+	for(int i=-WARMUP; i<count; i++) {
+		struct timespec start;
+		unsigned long before = heapAllocations;
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		struct Command* cmnd = newCommand();
+		cmnd->rawCommand = (char*)line;
+		runList(cmnd,&exitStatus);
+		arenaReset();
+		if(i >= 0) {
+			samples[i] = nanosSince(&start);
+			allocs += heapAllocations - before;
+		}
+	}
+	report(name,count,allocs);
+}
+
+//Launch a burst of background jobs, then reap them all through the child event loop.
+void benchBackground(int count) {
+	struct timespec burst;
+	int exitStatus = 0;
+	clock_gettime(CLOCK_MONOTONIC,&burst);
+	for(int i=0; i<count; i++) {
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		struct Command* cmnd = newCommand();
+		cmnd->rawCommand = "/bin/true &";
+		if(parseCommand(cmnd)) {
+			routeCommand(cmnd,&exitStatus);
+		}
+		arenaReset();
+		samples[i] = nanosSince(&start);
+	}
+	while(numJobs > 0) {
+		waitChildEvent();
+		burnZombie();
+		arenaReset();
+	}
+	long total = nanosSince(&burst);
+	report("background launch",count,0);
+	dprintf(resultFd,"%-28s %d jobs launched and reaped in %.1f ms, %.0f jobs/s\n","background with reaping",
+			count,total / 1e6,count / (total / 1e9));
+}
+
+//Time from spawning a whole shell on an empty script to reaping it, what a container entrypoint pays.
+void benchStartup(char* prog) {
+	char name[64];
+	char* args[] = { prog, "/dev/null", NULL };
+	int count = SAMPLES / 4;
+	for(int i=-WARMUP; i<count; i++) {
+		struct timespec start;
+		pid_t pid;
+		int status;
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		if(posix_spawn(&pid,prog,NULL,NULL,args,environ) != 0) {
+			dprintf(resultFd,"bench: can't run %s.\n",prog);
+			return;
+		}
+		waitpid(pid,&status,0);
+		if(i >= 0) {
+			samples[i] = nanosSince(&start);
+		}
+	}
+	snprintf(name,sizeof(name),"startup %s",prog);
+	report(name,count,0);
+}
+
+//usage: bench [shell ...], timing the startup of each shell given as well.
+int main(int argc, char* argv[]) {
+	static char line[LINE_LENGTH + 1];
+	resultFd = dup(STDOUT_FILENO);
+	if(freopen("/dev/null","w",stdout) == NULL) {
+		perror("bench: /dev/null");
+		return 1;
+	}
+	sigintIgnore();
+	sigtstpSet();
+	childEventsSet();
+	cachePid();
+	interactive = false;
+
+	fillLine(line,"$$");
+	benchParse("parse all $$",line);
+	fillLine(line,"arg$$ ");
+	benchParse("parse long argument list",line);
+	fillLine(line,"echo $$ a$$b \"$$\" ");
+	benchParse("parse words with $$",line);
+	fillLine(line,"cat < in$$ > out$$ ");
+	benchParse("parse redirects",line);
+	fillLine(line,"$HOME ${PATH}/x $? ");
+	benchParse("parse variables",line);
+	benchParse("parse globs and braces","ls *.c bench/* /usr/bin/*sh x{1..20} *.{c,h,sh}");
+	parseCacheInit(64);
+	fillLine(line,"arg$$ ");
+	benchParse("parse long list, cached",line);
+	benchParse("parse short line, cached","cat < in > out | sort -u 2>> errors");
+	parseCacheSize = 0;
+	benchParse("parse short line","cat < in > out | sort -u 2>> errors");
+	benchRead();
+
+	benchRoute("builtin status","status",SAMPLES);
+	benchRoute("builtin wait","wait",SAMPLES);
+	benchRoute("builtin echo > /dev/null","echo hello > /dev/null",SAMPLES);
+	benchRoute("builtin list ; && ||","true && false || true; status",SAMPLES);
+	benchRoute("builtin echo $(echo)","echo $(echo hi) > /dev/null",SAMPLES / 4);
+	launcher = LAUNCH_SPAWN;
+	benchRoute("foreground /bin/true spawn","/bin/true",SAMPLES / 4);
+	launcher = LAUNCH_FORK;
+	benchRoute("foreground /bin/true fork","/bin/true",SAMPLES / 4);
+	launcher = LAUNCH_ZYGOTE;
+	benchRoute("foreground /bin/true zygote","/bin/true",SAMPLES / 4);
+	zygoteDrain();
+	launcher = LAUNCH_SPAWN;
+	benchRoute("foreground /bin/true limited","limit -c 50 /bin/true",SAMPLES / 4);
+	cgroupCleanup();
+	benchRoute("foreground redirects open","/bin/true < /dev/null > /dev/null 2> /dev/null",SAMPLES / 4);
+	uringState = URING_WANTED;
+	benchRoute("foreground redirects uring","/bin/true < /dev/null > /dev/null 2> /dev/null",SAMPLES / 4);
+	uringState = URING_OFF;
+	benchBackground(SAMPLES / 4);
+	for(int i=1; i<argc; i++) {
+		benchStartup(argv[i]);
+	}
+	return 0;
+}
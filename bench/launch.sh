@@ -0,0 +1,22 @@
+#!/bin/sh
+# Commands per second through each mshell launcher.
+# usage: bench/launch.sh [commands] [mshell binary]
+N=${1:-5000}
+MSHELL=${2:-./mshell}
+
+cmds=$(mktemp)
+trap 'rm -f "$cmds"' EXIT
+i=0
+while [ "$i" -lt "$N" ]; do
+	echo /bin/true
+	i=$((i+1))
+done > "$cmds"
+echo exit >> "$cmds"
+
+for launcher in spawn fork zygote; do
+	start=$(date +%s%N)
+	MSHELL_LAUNCHER=$launcher "$MSHELL" < "$cmds" > /dev/null
+	end=$(date +%s%N)
+	awk -v n="$N" -v ns="$((end-start))" -v l="$launcher" \
+		'BEGIN { printf "%-6s %8d commands %8.3f s %10.1f commands/s\n", l, n, ns/1e9, n/(ns/1e9) }'
+done
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Launches and reaps background jobs through each launcher while ^Z flips foreground-only mode
+# every 10 ms, then checks the shell left no zombies, kept a steady fd count and didn't grow.
+# Exits non-zero if any launcher fails a check.
+# usage: bench/stress.sh [jobs] [mshell binary]
+N=${1:-3000}
+MSHELL=${2:-./mshell}
+SLACK_KB=1024
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+# every 500 jobs the shell notes its fds and RSS; at the end, whatever children it still has.
+i=1
+while [ "$i" -le "$N" ]; do
+	echo "/bin/true &"
+	if [ $((i % 500)) -eq 0 ]; then
+		echo "ls /proc/\$\$/fd > $dir/fd.$i"
+		echo "grep VmRSS /proc/\$\$/status > $dir/rss.$i"
+	fi
+	i=$((i+1))
+done > "$dir/script"
+echo "sleep 1" >> "$dir/script"
+echo "ps -o stat= --ppid \$\$ > $dir/children" >> "$dir/script"
+
+failed=0
+for launcher in spawn fork zygote; do
+	rm -f "$dir"/fd.* "$dir"/rss.* "$dir/children"
+	MSHELL_LAUNCHER=$launcher "$MSHELL" "$dir/script" > "$dir/out" 2>&1 &
+	pid=$!
+	# the shell has to get its SIGTSTP handler in before the first ^Z.
+	sleep 0.3
+	while kill -TSTP "$pid" 2>/dev/null; do
+		sleep 0.01
+	done
+	wait "$pid"
+	# ls counts the fd it reads the directory with, so only the spread matters.
+	fds=$(for f in "$dir"/fd.*; do wc -l < "$f"; done | sort -n | awk 'NR == 1 { lo = $1 } { hi = $1 } END { print hi - lo }')
+	first=$(cat "$dir"/rss.500 2>/dev/null | awk '{ print $2 }')
+	last=$(cat "$dir"/rss.* 2>/dev/null | awk '{ print $2 }' | sort -n | tail -1)
+	zombies=$(grep -c Z "$dir/children" 2>/dev/null)
+	status=ok
+	if [ ! -s "$dir/rss.500" ] || [ ! -f "$dir/children" ]; then
+		status="FAILED: the script didn't finish"
+	elif [ "$zombies" -ne 0 ]; then
+		status="FAILED: $zombies zombies"
+	elif [ "$fds" -gt 1 ]; then
+		status="FAILED: fd count moved by $fds"
+	elif [ $((last - first)) -gt "$SLACK_KB" ]; then
+		status="FAILED: RSS grew from $first to $last KB"
+	fi
+	printf "%-6s %6d jobs  %-4s\n" "$launcher" "$N" "$status"
+	[ "$status" = ok ] || failed=1
+done
+exit $failed
@@ -0,0 +1,150 @@
+/* Fuzz target for the lexer and parseCommand. Each input is split into lines the way getCommand
+ * hands them out, and every line is parsed through its whole ';', '&&' and '||' list, then parsed
+ * again so the second pass comes out of the parse cache. Nothing runs: parseSkipping keeps $(...)
+ * from forking, and redirect targets are only recorded, never opened. Globs do read the current
+ * directory.
+ * libFuzzer: make fuzz CC=clang FUZZFLAGS="-fsanitize=fuzzer -DFUZZ_LIBFUZZER"
+ * AFL: make fuzz/parse_fuzz CC=afl-clang-fast, then afl-fuzz -i seeds -o out fuzz/parse_fuzz
+ * otherwise: fuzz/parse_fuzz [file ...] parses each file, or stdin, and fuzz/parse_fuzz -g count
+ * [seed] parses count generated lines of shell syntax, which is what make fuzz runs.
+ */
+#define MSHELL_NO_MAIN
+#include "../mshell.c"
+
+#define FUZZ_LINE 4096
+
+bool fuzzReady = false;
+
+void fuzzInit() {
+	cachePid();
+	interactive = false;
+	parseSkipping = true;
+	parseCacheInit(16);
+	fuzzReady = true;
+}
+
+//Parses one line and the rest of its list, the way runList walks it.
+void fuzzLine(char* line) {
+	struct Command* cmnd = newCommand();
+	cmnd->rawCommand = line;
+	while(1) {
+		parseCommand(cmnd);
+		char* rest = cmnd->listRest;
+		if(rest == NULL) {
+			break;
+		}
+		cmnd = newCommand();
+		cmnd->rawCommand = rest;
+	}
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	if(!fuzzReady) {
+		fuzzInit();
+	}
+	//the parser writes into its line, so every pass gets a fresh copy.
+	char* text = xmalloc(size + 1);
+	char* copy = xmalloc(size + 1);
+	memcpy(text,data,size);
+	text[size] = '\0';
+	for(char* line = text; line != NULL; ) {
+		char* newline = strchr(line,'\n');
+		if(newline != NULL) {
+			*newline = '\0';
+		}
+		for(int pass=0; pass<2; pass++) {
+			strcpy(copy,line);
+			fuzzLine(copy);
+			arenaReset();
+		}
+		line = newline ? newline + 1 : NULL;
+	}
+	free(copy);
+	free(text);
+	return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+//Pieces of shell syntax glued together at random, with the odd long word for the size paths.
+const char* fuzzTokens[] = {
+	"<", ">", ">>", "2>", "2>>", "2>&1", "&>", "&>>", "<<<", ">|", "|", "&", ";", "&&", "||",
+	"$", "${", "}", "$(", ")", "\"", "'", "\\", "*", "?", "[", "]", "[!a]", "{", ",", "..",
+	"{1..3}", "{a,b}", "a", "x*", "X=", "X=1", "$$", "$?", "$HOME", "${X}", "~", "#", "=", "-",
+	"!", "1", " ", " ", "\t", "\n"
+};
+
+void fuzzGenerate(long count, unsigned int seed) {
+	static char line[FUZZ_LINE + 1];
+	int numTokens = sizeof(fuzzTokens) / sizeof(fuzzTokens[0]);
+	srand(seed);
+	for(long i=0; i<count; i++) {
+		size_t length = 0;
+		for(int n = rand() % 40; n > 0; n--) {
+			const char* token = fuzzTokens[rand() % numTokens];
+			size_t tokenLength = strlen(token);
+			if(length + tokenLength > FUZZ_LINE) {
+				break;
+			}
+			memcpy(line + length,token,tokenLength);
+			length += tokenLength;
+		}
+		if(rand() % 50 == 0) {
+			size_t wordLength = rand() % 3000;
+			if(length + wordLength <= FUZZ_LINE) {
+				memset(line + length,'f',wordLength);
+				length += wordLength;
+			}
+		}
+		LLVMFuzzerTestOneInput((const uint8_t*)line,length);
+	}
+}
+
+//Reads all of a file, or stdin for NULL, and runs it as one input.
+void fuzzFile(const char* name) {
+	int fd = name ? open(name,O_RDONLY|O_CLOEXEC) : STDIN_FILENO;
+	if(fd == -1) {
+		perror(name);
+		exit(1);
+	}
+	size_t size = 0, capacity = 65536;
+	char* data = xmalloc(capacity);
+	ssize_t numChars;
+	while((numChars = read(fd,data + size,capacity - size)) > 0) {
+		size += numChars;
+		if(size == capacity) {
+			char* grown = xmalloc(capacity * 2);
+			memcpy(grown,data,size);
+			free(data);
+			data = grown;
+			capacity *= 2;
+		}
+	}
+	if(name != NULL) {
+		close(fd);
+	}
+	LLVMFuzzerTestOneInput((const uint8_t*)data,size);
+	free(data);
+}
+
+int main(int argc, char* argv[]) {
+	//syntax errors are expected by the thousand. The sanitizers write to fd 2, not stderr, so a
+	//report still gets out.
+	FILE* null = fopen("/dev/null","w");
+	if(null == NULL) {
+		return 1;
+	}
+	stdout = stderr = null;
+	if(argc > 2 && strcmp(argv[1],"-g")==0) {
+		fuzzGenerate(atol(argv[2]),argc > 3 ? atoi(argv[3]) : 1);
+	}
+	else if(argc == 1) {
+		fuzzFile(NULL);
+	}
+	else {
+		for(int i=1; i<argc; i++) {
+			fuzzFile(argv[i]);
+		}
+	}
+	return 0;
+}
+#endif
@@ -1,26 +1,77 @@
 /* Mathew McDade
  * Spring 2019
- * smallsh: A simple shell. Supports three builtin functions: cd, status, and exit. All other
+ * smallsh: A simple shell. Supports builtin functions cd, status, hash, history, jobs, wait, fg,
+ * bg, parallel, parsecache, time, limit, export, unset, and exit, and runs echo, printf, test and
+ * [, true, false, and pwd in the shell itself outside of pipelines and the background. All other
  * commands are forked and run using the exec() function. Non-builtin functions can be run in
  * background mode using the '&' character at the end of the command. Foreground only mode can be
  * toggled using the SIGTSTP signal, C^Z. When in foreground only mode, the background character
- * will be ignored. The shell supports a maximum of 512 arguments and a maximum input length of
- * 2048 characters. You probably won't use that many.
+ * will be ignored. Commands can be chained into a pipeline with '|', and redirected with '<', '>',
+ * '>>', '2>', '2>>', '2>&1', '&>', '&>>', '<<<' here-strings and '>|', which tees a copy of a
+ * stage's output into a file with tee(2) and splice(2). Commands on a line can be joined with ';',
+ * '&&' and '||'. $NAME, ${NAME}, $?, $$ and $(command) expand everywhere but single quotes, and
+ * NAME=value sets a shell variable. Unquoted words are brace expanded and globbed with '*', '?' and
+ * '[...]'. limit runs a command, or sets a default for background jobs, under a cgroup v2
+ * cpu.weight, memory.max and io.weight, falling back to nice, RLIMIT_AS and I/O priorities without
+ * cgroups; limit and parallel also take --cpus and --numa to pin jobs to CPUs or spread them over
+ * NUMA nodes. Lines, argument lists and file names have no limits beyond the ARG_MAX that exec()
+ * enforces.
+ * Commands are launched with posix_spawn by default; set MSHELL_LAUNCHER=fork to use the original
+ * fork() and exec() path instead, or zygote to hand commands to pre-forked helpers. MSHELL_IO=uring
+ * opens a pipeline's redirect files in one io_uring batch where the kernel allows it.
+ * MSHELL_TRACE_FD names an fd to log parse times and launch-to-exec latencies to, and
+ * MSHELL_PARSE_CACHE=entries keeps an LRU cache of parsed lines for repetitive input.
+ * MSHELL_EVENT_FD names an fd for a stream of parse, spawn, exit, stop, continue and mode events,
+ * as JSON lines or, with MSHELL_EVENT_FORMAT=binary, fixed records. Run as mshell script, or mshell
+ * -c command, to run commands without a prompt; the shell also drops the prompt whenever its input
+ * isn't a terminal. End of input exits the shell. mshell --serve socket keeps one shell running
+ * batches of commands sent over a UNIX socket, each connection with its own directory and status.
+ * Interactive sessions keep their history in $MSHELL_HISTFILE, or ~/.mshell_history, opened the
+ * first time it's needed. make mshell-static builds a static -O3 binary for container entrypoints,
+ * where startup time is most of a run.
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <poll.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <spawn.h>
+#include <sched.h>
+#include <linux/io_uring.h>
 
-#define MAX_ARGS 512
-#define MAX_INPUT 2048
+#define INLINE_ARGS 16
+#define MAX_PATH 4096
+#define HASH_BUCKETS 64
+#define VAR_BUCKETS 128
+#define MAX_NODES 64
+#define ARENA_BLOCK 16384
+#define EVENT_RING 65536		//a power of two.
+#define EVENT_TEXT_MAX 1024
+#define URING_ENTRIES 64
+#define SERVE_MAX_BATCH (64 << 20)
 
 /* Global flag values to service foreground only mode via the TSTP signal handler. Per the GNU C
  * library, "the behavior is undefined if a signal handler reads any nonlocal object, or writes to
@@ -28,25 +79,239 @@
  * https://www.gnu.org/software/autoconf/manual/autoconf-2.61/html_node/Volatile-Objects.html
  */
 volatile sig_atomic_t allowBackground = 1;
-volatile sig_atomic_t sigtstpTriggered = 0;
-volatile sig_atomic_t processActive = 0;
-//TSTP signal handler function declarations.
-void allowbackground();
-void foregroundonly();
+volatile sig_atomic_t sigtstpPending = 0;		//the mode changed and nobody has been told yet.
+//How commands are started: posix_spawn unless MSHELL_LAUNCHER says fork or zygote.
+enum Launcher { LAUNCH_SPAWN, LAUNCH_FORK, LAUNCH_ZYGOTE };
+enum Launcher launcher = LAUNCH_SPAWN;
+extern char** environ;
+/* Command path cache, the same idea as bash's hash table. A command name is searched for in PATH
+ * once and its absolute path is remembered, so later launches exec it directly instead of trying
+ * every PATH directory. The table is thrown out whenever PATH changes.
+ */
+struct HashEntry
+{
+	char* name;
+	char* path;
+	int hits;
+	struct HashEntry* next;
+};
+struct HashEntry* commandHash[HASH_BUCKETS];
+char* hashedPath = NULL;	//the PATH value the table was filled from.
+/* Shell variables, seeded from the environment at startup. Each one is a single "NAME=value"
+ * string so exported ones can go into environ as they are. environ itself is only rebuilt before
+ * a launch and only when an exported variable changed since the last one; strings it may still
+ * point at are kept on a retired list until then.
+ */
+struct Variable
+{
+	char* entry;		//"NAME=value".
+	size_t nameLength;
+	bool exported;
+	struct Variable* next;
+};
+struct Variable* variables[VAR_BUCKETS];
+struct Variable* retiredVariables = NULL;	//entries the current environ may still use.
+int numExported = 0;
+bool environDirty = false;
+char** shellEnviron = NULL;		//the environ we built, NULL while it is still the inherited one.
+int shellStatus = 0;			//the last command's status, for $?.
+/* Children the shell hasn't heard the last of. SIGCHLD is blocked and read from a signalfd, so the
+ * prompt and foreground waits can poll() for children exiting and reap them right away, with their
+ * statuses kept here until someone asks. Background jobs no longer sit as zombies until enter.
+ * The table is open addressed on pid with linear probing, so finding the job for a reaped pid is
+ * one probe or so however many jobs are running. Each background pipeline gets a process group of
+ * its own, which is what fg, bg and shutdown signal.
+ */
+enum JobState { JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+struct Job
+{
+	pid_t pid;			//0 marks an empty slot.
+	pid_t pgid;			//the job's own process group, or 0 if it shares the shell's.
+	int status;			//in waitpid() form, valid once the job stops or is done.
+	enum JobState state;
+	bool background;
+	unsigned long order;		//launch order, for listing.
+	struct timespec started;
+	struct rusage usage;		//from wait4(), once done.
+	char* commandLine;		//heap copy for background jobs, the arena's for foreground ones.
+	char* cgroup;			//heap path of the cgroup limit put it in, or NULL.
+	char* placement;		//heap description of the CPUs and node it was pinned to, or NULL.
+};
+struct Job* jobs = NULL;
+int jobsSize = 0;			//always a power of two.
+int numJobs = 0;
+int numDoneJobs = 0;		//finished background jobs waiting to be reported.
+bool serving = false;		//--serve, where exit ends the connection instead of the shell.
+unsigned long jobOrder = 0;
+int childEventFd = -1;
+//The rusage of every foreground process waited for since the time builtin last cleared it.
+struct rusage foregroundUsage;
+//MSHELL_TRACE_FD: where to log parse times and launch-to-exec latencies, or -1.
+int traceFd = -1;
+//MSHELL_EVENT_FD: where the event stream goes, or -1. MSHELL_EVENT_FORMAT=binary picks records.
+int eventFd = -1;
+bool eventBinary = false;
+
+/* Per-command bump arena. The Command struct, the input line, its tokens and redirect file names
+ * are all carved out of here, and the whole lot is dropped at once by arenaReset() before the next
+ * prompt, so the shell loop doesn't malloc and free its way through every command.
+ */
+struct ArenaBlock
+{
+	struct ArenaBlock* prev;
+	size_t size;
+	size_t used;
+	char data[];
+};
+struct ArenaBlock* arena = NULL;
+//Every heap allocation the shell makes for itself is counted here, so a steady-state loop can be
+//checked for doing none.
+unsigned long heapAllocations = 0;
 
-//This is a large struct but it makes passing all command information much neater.
+/* This is a large struct but it makes passing all command information much neater. A pipeline is
+ * a list of Commands linked through pipeNext, one per stage; the first one holds the raw input and
+ * the background flag for the whole pipeline, and the operator joining it to the rest of the line.
+ */
+enum ListOp { LIST_NONE, LIST_SEQUENCE, LIST_AND, LIST_OR };
 struct Command
 {
-	char rawCommand[MAX_INPUT];	//raw user input, will get destroyed by strtok in parser function.
+	char* rawCommand;			//raw user input, left as is by the parser.
 	int numArgs;
-	char* args[MAX_ARGS];		//an array to hold distinct command units.
+	int argsSize;				//slots in args, which starts out as inlineArgs.
+	char** args;				//an array to hold distinct command units, NULL terminated.
+	char* inlineArgs[INLINE_ARGS];
 	bool inputRedirect;			//flag for '<' command.
-	char inputFile[50];
+	char* inputFile;			//NULL if '<' had no file name.
+	char* hereString;			//text for '<<<', fed in instead of inputFile.
 	bool outputRedirect;		//flag for '>' command.
-	char outputFile[50];
+	char* outputFile;
+	bool appendOutput;			//'>>' rather than '>'.
+	bool errorRedirect;			//flag for '2>' command.
+	char* errorFile;
+	bool errorAppend;			//'2>>' rather than '2>'.
+	bool errorToOutput;			//'2>&1' or '&>': stderr goes wherever stdout ends up.
+	bool errorBeforeOutput;		//'2>&1 >file': stderr keeps stdout's target from before the file.
+	char* teeFile;				//'>|': a copy of stdout goes here, through a tee stage after this one.
 	bool backgroundProcess;		//flag for '&' command.
 	pid_t pid;
+	bool redirectsOpened;		//the io_uring pass already opened this stage's targets into redirectFds,
+	bool redirectsFailed;		//or found one it couldn't and left them all closed.
+	int redirectFds[3];
+	int pipeIn;					//read end of the pipe from the previous stage, or -1.
+	int pipeOut;				//write end of the pipe to the next stage, or -1.
+	struct Command* pipeNext;	//next stage in the pipeline.
+	enum ListOp listOp;			//';', '&&' or '||' after the pipeline, if any.
+	char* listRest;				//the raw input after that operator, parsed once this has run.
+	bool syntaxError;			//the parser said why it couldn't make sense of the line.
+};
+
+//Counted malloc. Running out of memory in a shell isn't something to limp along from.
+void* xmalloc(size_t size) {
+	void* ptr = malloc(size);
+	if(ptr == NULL) {
+		perror("Out of memory");
+		exit(1);
+	}
+	heapAllocations++;
+	return ptr;
+}
+char* xstrdup(const char* str) {
+	size_t len = strlen(str) + 1;
+	return memcpy(xmalloc(len),str,len);
+}
+
+//Bump allocate from the arena, growing it by a new block when the current one is full.
+void* arenaAlloc(size_t size) {
+	size = (size + 7) & ~(size_t)7;
+	if(arena == NULL || arena->size - arena->used < size) {
+		size_t blockSize = ARENA_BLOCK;
+		while(blockSize < size) {
+			blockSize *= 2;
+		}
+		struct ArenaBlock* block = xmalloc(sizeof(struct ArenaBlock) + blockSize);
+		block->prev = arena;
+		block->size = blockSize;
+		block->used = 0;
+		arena = block;
+	}
+	void* ptr = arena->data + arena->used;
+	arena->used += size;
+	return ptr;
+}
+void* arenaCalloc(size_t size) {
+	return memset(arenaAlloc(size),0,size);
+}
+char* arenaStrdup(const char* str) {
+	size_t len = strlen(str) + 1;
+	return memcpy(arenaAlloc(len),str,len);
+}
+
+//A point in the arena to roll back to, for loops that don't need to keep what each pass allocates.
+struct ArenaMark
+{
+	struct ArenaBlock* block;
+	size_t used;
 };
+struct ArenaMark arenaMark() {
+	struct ArenaMark mark = { arena, arena ? arena->used : 0 };
+	return mark;
+}
+void arenaRelease(struct ArenaMark mark) {
+	while(arena != mark.block) {
+		struct ArenaBlock* prev = arena->prev;
+		free(arena);
+		arena = prev;
+	}
+	if(arena != NULL) {
+		arena->used = mark.used;
+	}
+}
+
+/* Drop everything allocated since the last reset. If the last command outgrew the first block, the
+ * chain is swapped for one block the size of all of it, so the next command like that one fits
+ * without growing again.
+ */
+void arenaReset() {
+	if(arena == NULL) {
+		return;
+	}
+	if(arena->prev != NULL) {
+		size_t total = 0;
+		while(arena != NULL) {
+			struct ArenaBlock* prev = arena->prev;
+			total += arena->size;
+			free(arena);
+			arena = prev;
+		}
+		arena = xmalloc(sizeof(struct ArenaBlock) + total);
+		arena->prev = NULL;
+		arena->size = total;
+	}
+	arena->used = 0;
+}
+
+//A zeroed Command from the arena, with no pipes attached.
+struct Command* newCommand() {
+	struct Command* cmnd = arenaCalloc(sizeof(struct Command));
+	cmnd->args = cmnd->inlineArgs;
+	cmnd->argsSize = INLINE_ARGS;
+	cmnd->pipeIn = -1;
+	cmnd->pipeOut = -1;
+	return cmnd;
+}
+
+/* Appends an argument, leaving room for the NULL after it. Past the inline slots the array moves into
+ * the arena and doubles, so the only limit on arguments is what exec will take.
+ */
+void addArg(struct Command* cmnd, char* arg) {
+	if(cmnd->numArgs + 1 == cmnd->argsSize) {
+		char** grown = arenaAlloc(cmnd->argsSize * 2 * sizeof(char*));
+		memcpy(grown,cmnd->args,cmnd->numArgs * sizeof(char*));
+		cmnd->args = grown;
+		cmnd->argsSize *= 2;
+	}
+	cmnd->args[cmnd->numArgs++] = arg;
+}
 
 /* smallsh builtin: status
  * Takes no arguments. Prints the exit status of most recently completed process.
@@ -62,6 +327,146 @@ void reportStatus(int status) {
 	}
 }
 
+//The status as a process exit code, the way sh reports it: 128 plus the signal for a killed command.
+int exitCode(int status) {
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+//Writes a short string to a file, the way sysfs and cgroupfs want it. Returns false on failure.
+bool writeFile(const char* path, const char* text) {
+	int fd = open(path,O_WRONLY | O_CLOEXEC);
+	if(fd == -1) {
+		return false;
+	}
+	bool written = write(fd,text,strlen(text)) == (ssize_t)strlen(text);
+	close(fd);
+	return written;
+}
+
+//Reads up to size - 1 bytes of a file into buf, null terminated. Returns false if it can't be read.
+bool readFile(const char* path, char* buf, size_t size) {
+	int fd = open(path,O_RDONLY | O_CLOEXEC);
+	if(fd == -1) {
+		return false;
+	}
+	ssize_t length = read(fd,buf,size - 1);
+	close(fd);
+	buf[length > 0 ? length : 0] = '\0';
+	return length >= 0;
+}
+
+//FNV-1a, plenty for a few dozen command names or variables.
+unsigned int hashBytes(const char* str, size_t length) {
+	unsigned int hash = 2166136261u;
+	for(size_t i=0; i<length; i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+unsigned int hashString(const char* str) {
+	return hashBytes(str,strlen(str));
+}
+
+//True for a valid variable name: a letter or underscore, then letters, digits and underscores.
+bool validName(const char* name, size_t length) {
+	if(length == 0 || isdigit((unsigned char)name[0])) {
+		return false;
+	}
+	for(size_t i=0; i<length; i++) {
+		if(!isalnum((unsigned char)name[i]) && name[i] != '_') {
+			return false;
+		}
+	}
+	return true;
+}
+
+void variablesInit();
+bool variablesLoaded = false;
+
+//Finds a variable by a name that doesn't have to be null terminated, for the lexer.
+struct Variable** findVariable(const char* name, size_t length) {
+	if(!variablesLoaded) {
+		variablesInit();
+	}
+	struct Variable** link = &variables[hashBytes(name,length) % VAR_BUCKETS];
+	while(*link != NULL && ((*link)->nameLength != length || memcmp((*link)->entry,name,length) != 0)) {
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+//The value of a variable, or NULL if it isn't set.
+char* variableValue(const char* name) {
+	struct Variable* var = *findVariable(name,strlen(name));
+	return var ? var->entry + var->nameLength + 1 : NULL;
+}
+
+//Retires a variable's entry, which stays alive until environ is next rebuilt if it was exported.
+void retireEntry(struct Variable* var) {
+	if(var->exported) {
+		struct Variable* old = xmalloc(sizeof(struct Variable));
+		old->entry = var->entry;
+		old->next = retiredVariables;
+		retiredVariables = old;
+		environDirty = true;
+	}
+	else {
+		free(var->entry);
+	}
+}
+
+/* Sets a variable from a "NAME=value" string. The variable is exported if export is true or it
+ * already was, the way sh keeps the export flag across assignments.
+ */
+void setVariable(const char* assignment, bool export) {
+	size_t nameLength = strchr(assignment,'=') - assignment;
+	struct Variable** link = findVariable(assignment,nameLength);
+	struct Variable* var = *link;
+	if(var == NULL) {
+		var = *link = xmalloc(sizeof(struct Variable));
+		var->nameLength = nameLength;
+		var->exported = false;
+		var->next = NULL;
+	}
+	else {
+		retireEntry(var);
+	}
+	var->entry = xstrdup(assignment);
+	if(export && !var->exported) {
+		var->exported = true;
+		numExported++;
+	}
+	environDirty |= var->exported;
+}
+
+void unsetVariable(const char* name) {
+	struct Variable** link = findVariable(name,strlen(name));
+	struct Variable* var = *link;
+	if(var != NULL) {
+		*link = var->next;
+		retireEntry(var);
+		numExported -= var->exported;
+		free(var);
+	}
+}
+
+/* Loads the inherited environment into the variable table, all of it exported. That's a copy of
+ * every variable, so it waits for the first lookup; until then environ is the inherited one.
+ */
+void variablesInit() {
+	variablesLoaded = true;
+	for(char** env = environ; *env != NULL; env++) {
+		char* equals = strchr(*env,'=');
+		if(equals != NULL && validName(*env,equals - *env)) {
+			setVariable(*env,true);
+		}
+	}
+	//environ already has all of these, so there's nothing to rebuild yet.
+	environDirty = false;
+}
+
 /* smallsh builtin: cd
  * Takes a single argument, the path to the dir to be changed to. This can be the relative or
  * absolute path. If no argument is provided cd will change the current directory to the user's
@@ -69,7 +474,10 @@ void reportStatus(int status) {
  */
 void cd(char* dir) {
 	if(dir==NULL) {
-		chdir(getenv("HOME"));
+		char* home = variableValue("HOME");
+		if(home != NULL) {
+			chdir(home);
+		}
 	}
 	else {
 		if(chdir(dir)!=0) {
@@ -79,358 +487,4740 @@ void cd(char* dir) {
 	}
 }
 
-
-//Check if any zombies are available and, if so, print its pid and exit status.
-void burnZombie() {
-	pid_t zPid;
-	int zStatus;
-	//Don't wait for a zombie to appear, obviously.
-	while((zPid = waitpid(0,&zStatus,WNOHANG)) > 0) {
-		if(zPid > 0) {
-			printf("background pid %d is done: ",zPid);
-			reportStatus(zStatus);
+//Empty the command path cache.
+void hashReset() {
+	for(int i=0; i<HASH_BUCKETS; i++) {
+		while(commandHash[i] != NULL) {
+			struct HashEntry* entry = commandHash[i];
+			commandHash[i] = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
 		}
 	}
 }
 
-//Burn all the zombies, kill all the children. Closing up shop.
-void burnEverything() {
-	int status;
-	pid_t pid;
-	while((pid = waitpid(-1,&status,WNOHANG)) > 0) {};
-	//important not to terminate yourself, yet.
-	signal(SIGTERM,SIG_IGN);
-	kill(0,SIGTERM);
-	while((pid = waitpid(-1,&status,WNOHANG)) > 0) {};
+//Drop one command from the cache, used when its remembered path no longer execs.
+void hashForget(const char* name) {
+	struct HashEntry** link = &commandHash[hashString(name) % HASH_BUCKETS];
+	while(*link != NULL) {
+		if(strcmp((*link)->name,name)==0) {
+			struct HashEntry* entry = *link;
+			*link = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			return;
+		}
+		link = &(*link)->next;
+	}
 }
 
-//signal handling tools.
-void sigintIgnore() {
-	struct sigaction SIGINT_action = {{0}};
-	SIGINT_action.sa_handler = SIG_IGN;
-	sigaction(SIGINT,&SIGINT_action,NULL);
+//Flush the cache if PATH is not what it was when the cache was filled.
+void hashCheckPath() {
+	char* path = variableValue("PATH");
+	if(path == NULL) {
+		path = "";
+	}
+	if(hashedPath == NULL || strcmp(hashedPath,path)!=0) {
+		hashReset();
+		free(hashedPath);
+		hashedPath = xstrdup(path);
+	}
 }
-void sigintDefault() {
-	struct sigaction SIGINT_action = {{0}};
-	SIGINT_action.sa_handler = SIG_DFL;
-	sigaction(SIGINT,&SIGINT_action,NULL);
+
+//Search PATH for an executable the way execvp would. Returns a malloc'd path or NULL.
+char* searchPath(const char* name) {
+	char* dirs = hashedPath;
+	char candidate[MAX_PATH];
+	struct stat info;
+	while(dirs != NULL) {
+		char* end = strchr(dirs,':');
+		int dirLen = end ? (int)(end - dirs) : (int)strlen(dirs);
+		//an empty PATH entry means the current directory.
+		if(snprintf(candidate,MAX_PATH,"%.*s/%s",dirLen ? dirLen : 1,dirLen ? dirs : ".",name) < MAX_PATH
+				&& stat(candidate,&info)==0 && S_ISREG(info.st_mode) && access(candidate,X_OK)==0) {
+			return xstrdup(candidate);
+		}
+		dirs = end ? end + 1 : NULL;
+	}
+	return NULL;
 }
-//The TSTP signal handler functions could definitely be combined, need to do this.			!!
-//It was also difficult to get the desired behaviour of immediate vs. delayed message output.
-void allowbackground() {
-	struct sigaction query;
-	if(sigaction(SIGTSTP,NULL,&query) == -1) {
-		//handle error.
+
+/* Returns the path to exec for a command name. Names with a slash are used as they are, anything
+ * else comes from the cache, or from a PATH search that then gets cached. NULL if not found.
+ */
+char* lookupCommand(const char* name) {
+	if(strchr(name,'/') != NULL) {
+		return (char*)name;
 	}
-	else {
-		query.sa_handler = foregroundonly;
-		if(sigaction(SIGTSTP,&query,NULL) == -1) {
-			//handle error.
+	hashCheckPath();
+	unsigned int bucket = hashString(name) % HASH_BUCKETS;
+	for(struct HashEntry* entry = commandHash[bucket]; entry != NULL; entry = entry->next) {
+		if(strcmp(entry->name,name)==0) {
+			entry->hits++;
+			return entry->path;
 		}
-		else {
-			allowBackground = true;
-			sigtstpTriggered = true;
-			if(!processActive) {
-				char* bgOn = "\nExiting foreground-only mode.\n: ";
-				//using write() for reentrant safe output.
-				write(STDOUT_FILENO, bgOn, strlen(bgOn));
-				fflush(stdout);
-				sigtstpTriggered = false;
-			}
-		}	 
 	}
+	char* path = searchPath(name);
+	if(path == NULL) {
+		return NULL;
+	}
+	struct HashEntry* entry = xmalloc(sizeof(struct HashEntry));
+	entry->name = xstrdup(name);
+	entry->path = path;
+	entry->hits = 1;
+	entry->next = commandHash[bucket];
+	commandHash[bucket] = entry;
+	return path;
 }
-void foregroundonly() {
-	struct sigaction query;
-	if(sigaction(SIGTSTP,NULL,&query) == -1) {
-		//handle error.
+
+/* smallsh builtin: hash
+ * With no arguments, lists the cached command paths and how often each was used. -r empties the
+ * cache, and any other arguments are looked up and added to it.
+ */
+void hash(char** args) {
+	if(args[1] == NULL) {
+		bool empty = true;
+		for(int i=0; i<HASH_BUCKETS; i++) {
+			for(struct HashEntry* entry = commandHash[i]; entry != NULL; entry = entry->next) {
+				if(empty) {
+					printf("hits\tcommand\n");
+					empty = false;
+				}
+				printf("%4d\t%s\n",entry->hits,entry->path);
+			}
+		}
+		if(empty) {
+			printf("hash: hash table empty\n");
+		}
+		fflush(stdout);
+		return;
 	}
-	else {
-		query.sa_handler = allowbackground;
-		if(sigaction(SIGTSTP,&query,NULL) == -1) {
-			//handle error.
+	for(int i=1; args[i] != NULL; i++) {
+		if(strcmp(args[i],"-r")==0) {
+			hashReset();
 		}
-		else {
-			allowBackground = false;
-			sigtstpTriggered = true;
-			if(!processActive) {
-				char* bgOff = "\nEntering foreground-only mode (& is now ignored).\n: ";
-				write(STDOUT_FILENO, bgOff, strlen(bgOff));
-				fflush(stdout);
-				sigtstpTriggered = false;
-			}
+		else if(lookupCommand(args[i]) == NULL) {
+			fprintf(stderr,"hash: %s: not found\n",args[i]);
+			fflush(stderr);
 		}
 	}
 }
 
-void sigtstpSet() {
-	struct sigaction sa;
-	sa.sa_handler = foregroundonly;
-	sigfillset(&sa.sa_mask);
-	sa.sa_flags = SA_RESTART;
-	if(sigaction(SIGTSTP,&sa,NULL) == -1) {
-		perror("SIGTSTP init error.\n");
-		fflush(stderr);
+/* Event stream, for supervisors that would otherwise scrape "background pid 12 is done". Each
+ * parse, spawn, exit, stop, continue and ^Z mode change is appended to a ring and the ring goes out
+ * with one writev() of its two halves before the shell blocks on input or a child, so a busy script
+ * makes one write per command rather than one per event. An event that doesn't fit flushes first.
+ * If the fd can't take a batch, the batch is dropped rather than stalling the shell on an error.
+ * JSON lines look like {"event":"exit","time":ns,"pid":12,"code":0,"utime_us":..}, with "signal"
+ * instead of "code" for a killed process. The binary format is a stream of EventRecords in host
+ * byte order, each followed by textLength bytes of text and padded out to size.
+ */
+enum EventType { EVENT_PARSE = 1, EVENT_SPAWN, EVENT_EXIT, EVENT_STOP, EVENT_CONTINUE, EVENT_MODE };
+struct EventRecord
+{
+	uint32_t size;			//of the whole record with its text, a multiple of 8.
+	uint16_t type;
+	uint16_t textLength;		//the command line, at most EVENT_TEXT_MAX bytes of it.
+	int64_t time;			//CLOCK_REALTIME nanoseconds.
+	int32_t pid;
+	//parse: 1 if cached. spawn: the pgid. exit, stop: the waitpid() status. mode: 1 for foreground-only.
+	int32_t value;
+	//parse: nanoseconds. spawn: 1 if background. exit: user and system microseconds, max RSS in KB.
+	int64_t a, b, c;
+};
+char eventRing[EVENT_RING];
+unsigned int eventHead = 0, eventTail = 0;	//free running; the ring holds eventHead - eventTail bytes.
+
+void eventFlush() {
+	while(eventTail != eventHead) {
+		unsigned int start = eventTail & (EVENT_RING - 1);
+		unsigned int length = eventHead - eventTail;
+		unsigned int first = length < EVENT_RING - start ? length : EVENT_RING - start;
+		struct iovec parts[2] = { { eventRing + start, first }, { eventRing, length - first } };
+		ssize_t written = writev(eventFd,parts,2);
+		if(written == -1 && errno == EINTR) {
+			continue;
+		}
+		if(written <= 0) {
+			eventTail = eventHead;
+			return;
+		}
+		eventTail += written;
 	}
 }
 
-//Takes care of all input and output redirection for commands.
-void inputoutputRedirect(struct Command* cmnd) {
-	int ifile,ofile;
-	if(cmnd->inputRedirect) {
-		//if input redirect without argument, redirect to /dev/null:
-	     if(strlen(cmnd->inputFile)==0) {
-			ifile = open("/dev/null",O_RDONLY);
-			if(ifile == -1) {
-				perror("smallsh: cannot open /dev/null input.\n");
-				fflush(stderr);
-				exit(EXIT_FAILURE);
-			}
-			if(dup2(ifile,STDIN_FILENO) == -1) {
-				perror("smallsh: cannot open /dev/null input.\n");
-				fflush(stderr);
-				exit(EXIT_FAILURE);
-			}
-	     }
-		//redirect from specified input file.
-	     else {
-	          ifile = open(cmnd->inputFile,O_RDONLY);
-	          if(ifile==-1) {
-	      	    fprintf(stderr,"Unable to open input file: %s.\n",cmnd->inputFile);
-			    fflush(stderr);
-	      	    exit(EXIT_FAILURE);
-	          }
-	          if(dup2(ifile,STDIN_FILENO) == -1) {
-	      	    fprintf(stderr,"Unable to open input file: %s.\n",cmnd->inputFile);
-			    fflush(stderr);
-			    exit(EXIT_FAILURE);
-	      	}
-	     }
-		close(ifile);
-	}
-	if(cmnd->outputRedirect) {
-		//if output redirect without argument, redirect to /dev/null:
-	     if(strlen(cmnd->outputFile)==0) {
-			ofile = open("/dev/null",O_WRONLY|O_CREAT|O_TRUNC,0644);
-			if(ofile == -1) {
-				perror("smallsh: cannot open /dev/null output.\n");
-				fflush(stderr);
-				exit(EXIT_FAILURE);
-			}
-			if(dup2(ofile,STDOUT_FILENO) == -1) {
-				perror("smallsh: cannot open /dev/null output.\n");
-				fflush(stderr);
-				exit(EXIT_FAILURE);
-			}
-	     }
-		//redirect from specified input file.
-	     else {
-	          ofile = open(cmnd->outputFile,O_WRONLY|O_CREAT|O_TRUNC,0644);
-	          if(ofile==-1) {
-	      	    fprintf(stderr,"Unable to open output file: %s.\n",cmnd->outputFile);
-			    fflush(stderr);
-	      	    exit(EXIT_FAILURE);
-	          }
-	          if(dup2(ofile,STDOUT_FILENO) == -1) {
-	      	    fprintf(stderr,"Unable to open output file: %s.\n",cmnd->outputFile);
-			    fflush(stderr);
-			    exit(EXIT_FAILURE);
-	      	}
-		}
-		close(ofile);
-	}
-}
-
-//Adapted from Block 3.3: Advanced User Input example code.
-void getCommand(struct Command* cmnd) {
-	int numChars = -1;
-	size_t bufferSize = 0;
-	char* line = NULL;
-	//loops until user gives us a potentially viable command.
-	while(1) {
-		printf(": ");
-		fflush(stdout);
-		numChars = getline(&line,&bufferSize,stdin);
-		//if the user entered nothing or if it's a comment line
-		if(numChars <= 1 || line[0]==' ' || line[0]=='#') {
-			clearerr(stdin);
+void eventPut(const void* data, size_t length) {
+	if(EVENT_RING - (eventHead - eventTail) < length) {
+		eventFlush();
+	}
+	unsigned int start = eventHead & (EVENT_RING - 1);
+	size_t first = length < EVENT_RING - start ? length : EVENT_RING - start;
+	memcpy(eventRing + start,data,first);
+	memcpy(eventRing,(const char*)data + first,length - first);
+	eventHead += length;
+}
+
+//Appends text as a JSON string, quotes and all. Returns the end of it in out.
+char* jsonString(char* out, const char* text, size_t length) {
+	*out++ = '"';
+	for(size_t i=0; i<length; i++) {
+		unsigned char c = text[i];
+		if(c == '"' || c == '\\') {
+			*out++ = '\\';
+			*out++ = c;
+		}
+		else if(c < 0x20) {
+			out += sprintf(out,"\\u%04x",c);
 		}
 		else {
-			//append a null terminator.
-			line[strcspn(line,"\n")] = '\0';
-			strcpy(cmnd->rawCommand,line);
-			free(line);
-			line = NULL;
-			break;
+			*out++ = c;
 		}
 	}
+	*out++ = '"';
+	return out;
 }
 
-//Turns the raw user command input into useful information in the Command struct.
-void parseCommand(struct Command* cmnd) {
-	char buff[2048];
-	char* pos;
-	//sweet $$ expansion. I like this one.
-	while((pos = strstr(cmnd->rawCommand,"$$"))) {
-		strcpy(buff,pos+2);
-		sprintf(pos,"%d%s",getpid(),buff);
+/* Logs one event. Which of value, a, b and c mean anything, and text, depends on the type, as for
+ * EventRecord.
+ */
+void logEvent(enum EventType type, pid_t pid, int value, long a, long b, long c, const char* text) {
+	static const char* names[] = { "", "parse", "spawn", "exit", "stop", "continue", "mode" };
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+	long time = now.tv_sec * 1000000000L + now.tv_nsec;
+	//list elements keep the space after the operator before them.
+	text = text ? text + strspn(text," \t") : NULL;
+	size_t textLength = text ? strnlen(text,EVENT_TEXT_MAX) : 0;
+	if(eventBinary) {
+		char record[sizeof(struct EventRecord) + EVENT_TEXT_MAX + 8] = {0};
+		struct EventRecord* event = (struct EventRecord*)record;
+		event->size = (sizeof(struct EventRecord) + textLength + 7) & ~7;
+		event->type = type;
+		event->textLength = textLength;
+		event->time = time;
+		event->pid = pid;
+		event->value = value;
+		event->a = a;
+		event->b = b;
+		event->c = c;
+		memcpy(record + sizeof(struct EventRecord),text,textLength);
+		eventPut(record,event->size);
+		return;
 	}
-	//Begin tokenizing the raw user input.
-	char* token = strtok(cmnd->rawCommand," ");
-	while(token != NULL) {
-		//flag input redirect and store file name, might get broken by '< >' input.		!!
-		if(strcmp(token,"<")==0) {
-			cmnd->inputRedirect = true;
-			token = strtok(NULL," ");
-			strcpy(cmnd->inputFile,token);
-			token = strtok(NULL," ");
-		}
-		//flag output redirect and store file name, might get broken by '> &' input.		!!
-		else if(strcmp(token, ">")==0) {
-			cmnd->outputRedirect = true;
-			token = strtok(NULL," ");
-			strcpy(cmnd->outputFile,token);
-			token = strtok(NULL," ");
-		}
-		//else add the token to the command array.
-		else {
-			cmnd->args[cmnd->numArgs++] = token;
-			token = strtok(NULL," ");
+	char line[6 * EVENT_TEXT_MAX + 256];
+	char* out = line + sprintf(line,"{\"event\":\"%s\",\"time\":%ld",names[type],time);
+	if(type != EVENT_PARSE && type != EVENT_MODE) {
+		out += sprintf(out,",\"pid\":%d",pid);
+	}
+	switch(type) {
+	case EVENT_PARSE:
+		out += sprintf(out,",\"nanos\":%ld,\"cached\":%s",a,value ? "true" : "false");
+		break;
+	case EVENT_SPAWN:
+		out += sprintf(out,",\"pgid\":%d,\"background\":%s",value,a ? "true" : "false");
+		break;
+	case EVENT_EXIT:
+		out += WIFSIGNALED(value) ? sprintf(out,",\"signal\":%d",WTERMSIG(value)) :
+				sprintf(out,",\"code\":%d",WEXITSTATUS(value));
+		out += sprintf(out,",\"utime_us\":%ld,\"stime_us\":%ld,\"maxrss_kb\":%ld",a,b,c);
+		break;
+	case EVENT_STOP:
+		out += sprintf(out,",\"signal\":%d",WSTOPSIG(value));
+		break;
+	case EVENT_MODE:
+		out += sprintf(out,",\"foreground_only\":%s",value ? "true" : "false");
+		break;
+	default:
+		break;
+	}
+	if(text != NULL) {
+		out = jsonString(out + sprintf(out,",\"command\":"),text,textLength);
+	}
+	out += sprintf(out,"}\n");
+	eventPut(line,out - line);
+}
+
+//Home slot of a pid in the job table.
+int jobSlot(pid_t pid) {
+	return ((unsigned int)pid * 2654435761u) & (jobsSize - 1);
+}
+
+struct Job* findJob(pid_t pid) {
+	if(jobsSize == 0) {
+		return NULL;
+	}
+	for(int i = jobSlot(pid); jobs[i].pid != 0; i = (i + 1) & (jobsSize - 1)) {
+		if(jobs[i].pid == pid) {
+			return &jobs[i];
 		}
 	}
-	//flag background process and remove & from command array.
-	if(strcmp(cmnd->args[cmnd->numArgs-1], "&")==0) {
-		cmnd->backgroundProcess = true;
-		cmnd->args[cmnd->numArgs-1] = NULL;
+	return NULL;
+}
+
+//Place a job in the first free slot from its home. The table must have room.
+struct Job* insertJob(struct Job* job) {
+	int i = jobSlot(job->pid);
+	while(jobs[i].pid != 0) {
+		i = (i + 1) & (jobsSize - 1);
 	}
-	//make sure the command array is NULL terminated.
-	else {
-		cmnd->args[cmnd->numArgs] = NULL;
+	jobs[i] = *job;
+	return &jobs[i];
+}
+
+//Start tracking a child. The table doubles once it's half full.
+struct Job* addJob(pid_t pid, pid_t pgid, bool background, char* commandLine) {
+	if((numJobs + 1) * 2 > jobsSize) {
+		struct Job* old = jobs;
+		int oldSize = jobsSize;
+		jobsSize = jobsSize ? jobsSize * 2 : 64;
+		jobs = xmalloc(jobsSize * sizeof(struct Job));
+		memset(jobs,0,jobsSize * sizeof(struct Job));
+		for(int i=0; i<oldSize; i++) {
+			if(old[i].pid != 0) {
+				insertJob(&old[i]);
+			}
+		}
+		free(old);
+	}
+	struct Job job = {0};
+	job.pid = pid;
+	job.pgid = pgid;
+	job.state = JOB_RUNNING;
+	job.background = background;
+	job.order = jobOrder++;
+	clock_gettime(CLOCK_MONOTONIC,&job.started);
+	job.commandLine = background ? xstrdup(commandLine) : commandLine;
+	numJobs++;
+	if(eventFd != -1) {
+		logEvent(EVENT_SPAWN,pid,pgid,background,0,0,commandLine);
 	}
+	return insertJob(&job);
 }
 
-//Route commands to either builtin function or fork and execute.
-void routeCommand(struct Command* cmnd, int* exitStatus) {
-	processActive = true;
-	//Execute smallsh builtins.
-	if(strcmp(cmnd->args[0],"cd")==0) {
-		//cd function will check for a valid directory and chdir to HOME if no argument.
-		cd(cmnd->args[1]);
+//Forget a job. Later entries of the same probe run shift back into the hole, so no tombstones.
+void removeJob(struct Job* job) {
+	int hole = job - jobs;
+	if(job->background && job->state == JOB_DONE) {
+		numDoneJobs--;
 	}
-	else if(strcmp(cmnd->args[0],"status")==0) {
-		//print the most recent exit status.
-		reportStatus(*exitStatus);
+	if(job->background) {
+		free(job->commandLine);
 	}
-	else if(strcmp(cmnd->args[0],"exit")==0) {
-		burnEverything();
-		free(cmnd);
-		cmnd = NULL;
-		exit(0);
+	//the last stage out takes the pipeline's cgroup with it; before then it's still busy.
+	if(job->cgroup != NULL) {
+		rmdir(job->cgroup);
+		free(job->cgroup);
 	}
+	free(job->placement);
+	jobs[hole].pid = 0;
+	numJobs--;
+	for(int i = (hole + 1) & (jobsSize - 1); jobs[i].pid != 0; i = (i + 1) & (jobsSize - 1)) {
+		int home = jobSlot(jobs[i].pid);
+		//move it if its home isn't between the hole and where it sits now, cyclically.
+		if((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i)) {
+			jobs[hole] = jobs[i];
+			jobs[i].pid = 0;
+			hole = i;
+		}
+	}
+}
 
-	//Else route non-builtins to foreground or background mode exec.
-	else {
-		pid_t childPid = fork();
-		switch(childPid) {
-			//fork error.
-			case(-1): {
-						perror("Hull Breach!\n");
-						exit(1);
-					}
-			//in the child process.
-			case(0): {
-
-						signal(SIGTSTP,SIG_IGN);
-						//if command run with & flag and not in foreground only mode:
-						if(cmnd->backgroundProcess && allowBackground) {
-							//if the command doesn't already have a file redirect,
-							//set the redirect flag to true, which the redirect handler
-							//will point to /dev/null.
-							if(!cmnd->inputRedirect) {
-								cmnd->inputRedirect = true;
-							}
-							if(!cmnd->outputRedirect) {
-								cmnd->outputRedirect = true;
-							}
-						}
-						//else the process is foreground, so enable SIGINT.
-						else {
-							sigintDefault();
-						}
-						inputoutputRedirect(cmnd);
-						//execute.
-						execvp(cmnd->args[0],cmnd->args);
-						fprintf(stderr, "%s: no such file or directory.\n", cmnd->args[0]);
-						fflush(stderr);
-						exit(EXIT_FAILURE);
-				    }
-			//in the parent process.
-			default: {
-					    //if child is a background process:
-					    if(cmnd->backgroundProcess && allowBackground) {
-							printf("background pid is %d\n",childPid);
-							fflush(stdout);
-					    }
-					    //else child is in foreground.
-					    else {
-							waitpid(childPid,exitStatus,0);
-							if(WIFSIGNALED(*exitStatus)) {
-								printf("terminated by signal %d\n",WTERMSIG(*exitStatus));
-								fflush(stdout);
-							}
-							if(sigtstpTriggered) {
-								if(allowBackground) {
-									printf("\nExiting foreground-only mode.\n");
-									fflush(stdout);
-								}
-								else {
-									printf("\nEntering foreground-only mode (& will be ignored).\n");
-									fflush(stdout);
-								}
-								sigtstpTriggered = false;
-							}
-
-					    }
-				    }
-			//I don't like this gap.
-		}
-	}
-	processActive = false;
+//The live background job started last, or NULL.
+struct Job* lastJob() {
+	struct Job* last = NULL;
+	for(int i=0; i<jobsSize; i++) {
+		if(jobs[i].pid != 0 && jobs[i].background && jobs[i].state != JOB_DONE &&
+				(last == NULL || jobs[i].order > last->order)) {
+			last = &jobs[i];
+		}
+	}
+	return last;
 }
 
-void shell(void) {
-	//handle signals.
-	sigintIgnore();
-	sigtstpSet();
-	int exitStatus = 0;
+//Background jobs in launch order, in an arena array ending with NULL.
+int compareJobOrder(const void* a, const void* b) {
+	const struct Job* x = *(struct Job* const*)a;
+	const struct Job* y = *(struct Job* const*)b;
+	return (x->order > y->order) - (x->order < y->order);
+}
+struct Job** backgroundJobs() {
+	struct Job** list = arenaAlloc((numJobs + 1) * sizeof(struct Job*));
+	int count = 0;
+	for(int i=0; i<jobsSize; i++) {
+		if(jobs[i].pid != 0 && jobs[i].background) {
+			list[count++] = &jobs[i];
+		}
+	}
+	qsort(list,count,sizeof(struct Job*),compareJobOrder);
+	list[count] = NULL;
+	return list;
+}
 
-	//start loop.
-	while(1) {
-		//allocate a Command struct.
-		struct Command* cmnd;
-		//calloc is very useful here due to setting member variables to 0, including bools.
-		cmnd = calloc(1, sizeof(struct Command));
-		
-		//scoop up a completed zombie process.
-		burnZombie();
+//Send a signal to a job, as a group if it has one of its own.
+void signalJob(struct Job* job, int sig) {
+	kill(job->pgid ? -job->pgid : job->pid,sig);
+}
 
-		//get user input.
-		getCommand(cmnd);
-		
-		//parse command.
-		parseCommand(cmnd);
+//Nanoseconds since a CLOCK_MONOTONIC start time.
+long nanosSince(struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
 
-		//route and execute command.
-		routeCommand(cmnd,&exitStatus);
+//Fold one process's rusage into a total. Times and context switches add up, max RSS is the largest.
+void addUsage(struct rusage* total, struct rusage* usage) {
+	timeradd(&total->ru_utime,&usage->ru_utime,&total->ru_utime);
+	timeradd(&total->ru_stime,&usage->ru_stime,&total->ru_stime);
+	if(usage->ru_maxrss > total->ru_maxrss) {
+		total->ru_maxrss = usage->ru_maxrss;
+	}
+	total->ru_nvcsw += usage->ru_nvcsw;
+	total->ru_nivcsw += usage->ru_nivcsw;
+}
 
-		//free Command struct.
-		free(cmnd);
-		cmnd = NULL;
+//Block SIGCHLD and open the signalfd it gets read from instead.
+void childEventsSet() {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask,SIGCHLD);
+	if(sigprocmask(SIG_BLOCK,&mask,NULL) == -1 ||
+			(childEventFd = signalfd(-1,&mask,SFD_NONBLOCK|SFD_CLOEXEC)) == -1) {
+		perror("SIGCHLD init error.\n");
+		fflush(stderr);
+		exit(1);
 	}
 }
 
-int main() 
-{
+/* Reap every child that has exited and record what happened to it, stops included, in the job
+ * table. wait4() rather than waitid(), so each job comes with its rusage.
+ */
+void reapChildren() {
+	struct signalfd_siginfo event;
+	struct rusage usage;
+	int status;
+	pid_t pid;
+	//SIGCHLDs coalesce, so the events only say to look. wait4() says who.
+	while(read(childEventFd,&event,sizeof(event)) > 0) {}
+	while((pid = wait4(-1,&status,WNOHANG|WUNTRACED|WCONTINUED,&usage)) > 0) {
+		struct Job* job = findJob(pid);
+		if(job == NULL) {
+			continue;
+		}
+		job->status = status;
+		if(WIFSTOPPED(status)) {
+			job->state = JOB_STOPPED;
+		}
+		else if(WIFCONTINUED(status)) {
+			job->state = JOB_RUNNING;
+		}
+		else {
+			job->state = JOB_DONE;
+			job->usage = usage;
+			if(job->background) {
+				numDoneJobs++;
+			}
+		}
+		if(eventFd != -1) {
+			if(job->state == JOB_DONE) {
+				logEvent(EVENT_EXIT,pid,status,usage.ru_utime.tv_sec * 1000000L + usage.ru_utime.tv_usec,
+						usage.ru_stime.tv_sec * 1000000L + usage.ru_stime.tv_usec,usage.ru_maxrss,NULL);
+			}
+			else {
+				logEvent(job->state == JOB_STOPPED ? EVENT_STOP : EVENT_CONTINUE,pid,status,0,0,0,NULL);
+			}
+		}
+	}
+}
+
+//Sleep until a child changes state, then reap it. A signal, like TSTP, cuts the wait short.
+void waitChildEvent() {
+	struct pollfd event = { childEventFd, POLLIN, 0 };
+	if(eventFd != -1) {
+		eventFlush();
+	}
+	if(poll(&event,1,-1) > 0) {
+		reapChildren();
+	}
+}
+
+/* Wait for a child through the event loop, reaping around it, until it's done or stopped. Returns
+ * its status. A finished child is forgotten; a stopped one stays in the table as a background job.
+ */
+int waitJob(struct Job* job) {
+	pid_t pid = job->pid;
+	while((job = findJob(pid))->state == JOB_RUNNING) {
+		waitChildEvent();
+	}
+	int status = job->status;
+	if(job->state == JOB_DONE) {
+		addUsage(&foregroundUsage,&job->usage);
+		removeJob(job);
+	}
+	else if(!job->background) {
+		job->background = true;
+		job->commandLine = xstrdup(job->commandLine);
+	}
+	return status;
+}
+
+//Report any background jobs that have finished since the last prompt, then forget them.
+void burnZombie() {
+	reapChildren();
+	if(numDoneJobs == 0) {
+		return;
+	}
+	struct Job** list = backgroundJobs();
+	pid_t* done = arenaAlloc(numDoneJobs * sizeof(pid_t));
+	int numDone = 0;
+	for(int i=0; list[i] != NULL; i++) {
+		if(list[i]->state == JOB_DONE) {
+			//under --serve, stdout is whichever client's batch is running, or the server's own.
+			if(!serving) {
+				printf("background pid %d is done: ",list[i]->pid);
+				reportStatus(list[i]->status);
+			}
+			done[numDone++] = list[i]->pid;
+		}
+	}
+	//slots move as jobs are removed, so go back in by pid.
+	for(int i=0; i<numDone; i++) {
+		removeJob(findJob(done[i]));
+	}
+}
+
+/* Kill all the children we started, and only those. Closing up shop. Each background job is sent
+ * TERM once per process group, stopped ones are woken up to receive it, and whatever's already
+ * gone gets reaped.
+ */
+void burnEverything() {
+	reapChildren();
+	for(int i=0; i<jobsSize; i++) {
+		struct Job* job = &jobs[i];
+		if(job->pid == 0 || job->state == JOB_DONE) {
+			continue;
+		}
+		//the group leader speaks for its pipeline, unless it's already gone.
+		if(job->pgid != 0 && job->pgid != job->pid) {
+			struct Job* leader = findJob(job->pgid);
+			if(leader != NULL && leader->state != JOB_DONE) {
+				continue;
+			}
+		}
+		signalJob(job,SIGTERM);
+		if(job->state == JOB_STOPPED) {
+			signalJob(job,SIGCONT);
+		}
+	}
+	reapChildren();
+}
+
+//Parses an optional pid argument for wait, fg and bg. Without one, the last background job.
+struct Job* jobArgument(char* name, char* arg) {
+	struct Job* job;
+	if(arg == NULL) {
+		job = lastJob();
+		if(job == NULL) {
+			fprintf(stderr,"%s: no current job\n",name);
+			fflush(stderr);
+		}
+		return job;
+	}
+	job = findJob(atoi(arg));
+	if(job == NULL || !job->background) {
+		fprintf(stderr,"%s: %s: no such job\n",name,arg);
+		fflush(stderr);
+		return NULL;
+	}
+	return job;
+}
+
+/* smallsh builtin: jobs
+ * Takes no arguments. Lists background jobs with their pid, state, run time and command line.
+ */
+void listJobs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	reapChildren();
+	struct Job** list = backgroundJobs();
+	for(int i=0; list[i] != NULL; i++) {
+		struct Job* job = list[i];
+		char* state = job->state == JOB_RUNNING ? "Running" : job->state == JOB_STOPPED ? "Stopped" : "Done";
+		double elapsed = (now.tv_sec - job->started.tv_sec) + (now.tv_nsec - job->started.tv_nsec) / 1e9;
+		printf("%d\t%-8s%8.1fs\t%s",job->pid,state,elapsed,job->commandLine);
+		if(job->placement != NULL) {
+			printf("\t[%s]",job->placement);
+		}
+		//limited jobs have a cgroup counting for them, shared by the stages of a pipeline.
+		char path[MAX_PATH + 32], stat[512];
+		if(job->cgroup != NULL && snprintf(path,sizeof(path),"%s/cpu.stat",job->cgroup) > 0 &&
+				readFile(path,stat,sizeof(stat)) && strncmp(stat,"usage_usec ",11)==0) {
+			printf("\t[cpu %.2fs",atoll(stat + 11) / 1e6);
+			snprintf(path,sizeof(path),"%s/memory.current",job->cgroup);
+			if(readFile(path,stat,sizeof(stat))) {
+				printf(", mem %.1f MB",atoll(stat) / 1048576.0);
+			}
+			printf("]");
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+/* smallsh builtin: wait
+ * Takes an optional pid. Waits for that background job to finish and makes its exit status the
+ * status, or without one waits for all running background jobs. Jobs collected this way aren't
+ * reported as done at the prompt.
+ */
+void waitBuiltin(char* arg, int* exitStatus) {
+	if(arg != NULL) {
+		struct Job* job = jobArgument("wait",arg);
+		if(job != NULL) {
+			*exitStatus = waitJob(job);
+		}
+		return;
+	}
+	//slots move as jobs are removed, so hold on to pids. Stopped jobs would never finish.
+	struct Job** list = backgroundJobs();
+	pid_t* pids = arenaAlloc((numJobs + 1) * sizeof(pid_t));
+	int count = 0;
+	for(int i=0; list[i] != NULL; i++) {
+		if(list[i]->state != JOB_STOPPED) {
+			pids[count++] = list[i]->pid;
+		}
+	}
+	for(int i=0; i<count; i++) {
+		waitJob(findJob(pids[i]));
+	}
+	*exitStatus = 0;
+}
+
+/* smallsh builtin: bg
+ * Takes an optional pid. Continues a stopped background job.
+ */
+void bgBuiltin(char* arg) {
+	struct Job* job = jobArgument("bg",arg);
+	if(job != NULL) {
+		signalJob(job,SIGCONT);
+		job->state = JOB_RUNNING;
+	}
+}
+
+/* smallsh builtin: fg
+ * Takes an optional pid. Continues a background job if it's stopped and waits for it in the
+ * foreground, handing it the terminal while it runs.
+ */
+void fgBuiltin(char* arg, int* exitStatus) {
+	struct Job* job = jobArgument("fg",arg);
+	if(job == NULL) {
+		return;
+	}
+	printf("%s\n",job->commandLine);
+	fflush(stdout);
+	bool terminal = job->pgid != 0 && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+	if(terminal) {
+		tcsetpgrp(STDIN_FILENO,job->pgid);
+	}
+	signalJob(job,SIGCONT);
+	job->state = JOB_RUNNING;
+	*exitStatus = waitJob(job);
+	if(terminal) {
+		//the shell is in the background now, so taking the terminal back would stop it without this.
+		sigset_t mask, old;
+		sigemptyset(&mask);
+		sigaddset(&mask,SIGTTOU);
+		sigprocmask(SIG_BLOCK,&mask,&old);
+		tcsetpgrp(STDIN_FILENO,getpgrp());
+		sigprocmask(SIG_SETMASK,&old,NULL);
+	}
+	if(WIFSIGNALED(*exitStatus)) {
+		printf("terminated by signal %d\n",WTERMSIG(*exitStatus));
+		fflush(stdout);
+	}
+}
+
+//signal handling tools.
+void sigintIgnore() {
+	struct sigaction SIGINT_action = {{0}};
+	SIGINT_action.sa_handler = SIG_IGN;
+	sigaction(SIGINT,&SIGINT_action,NULL);
+}
+void sigintDefault() {
+	struct sigaction SIGINT_action = {{0}};
+	SIGINT_action.sa_handler = SIG_DFL;
+	sigaction(SIGINT,&SIGINT_action,NULL);
+}
+/* The one SIGTSTP handler. It only flips the mode and leaves a note; the input loop prints the
+ * message, since nothing that buffers output is safe in here. SIGTSTP is blocked while it runs, so the
+ * flip can't race with itself.
+ */
+void sigtstpHandler(int sig) {
+	allowBackground = !allowBackground;
+	sigtstpPending = 1;
+}
+
+//Says which mode ^Z left the shell in, with a fresh prompt if it came while one was showing.
+void modeMessage(bool prompt) {
+	sigtstpPending = 0;
+	if(eventFd != -1) {
+		logEvent(EVENT_MODE,0,!allowBackground,0,0,0,NULL);
+	}
+	if(allowBackground) {
+		printf("\nExiting foreground-only mode.\n");
+	}
+	else {
+		printf("\nEntering foreground-only mode (& is now ignored).\n");
+	}
+	if(prompt) {
+		printf(": ");
+	}
+	fflush(stdout);
+}
+
+void sigtstpSet() {
+	struct sigaction sa;
+	sa.sa_handler = sigtstpHandler;
+	sigfillset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if(sigaction(SIGTSTP,&sa,NULL) == -1) {
+		perror("SIGTSTP init error.\n");
+		fflush(stderr);
+	}
+}
+
+//Opens a redirect target in the shell. No file name means /dev/null.
+int openRedirect(char* file, int flags, char* which) {
+	char* path = file == NULL ? "/dev/null" : file;
+	int fd = open(path,flags|O_CLOEXEC,0644);
+	if(fd == -1) {
+		fprintf(stderr,"Unable to open %s file: %s.\n",which,path);
+		fflush(stderr);
+	}
+	return fd;
+}
+
+//A here-string's text and a newline in a memfd, rewound for the command to read. No disk, no pipe limit.
+int hereStringFd(char* text) {
+	struct iovec parts[2] = { { text, strlen(text) }, { "\n", 1 } };
+	int fd = memfd_create("here-string",MFD_CLOEXEC);
+	if(fd == -1 || writev(fd,parts,2) != (ssize_t)(parts[0].iov_len + 1) || lseek(fd,0,SEEK_SET) == -1) {
+		perror("smallsh: here-string");
+		fflush(stderr);
+		if(fd != -1) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void closeRedirects(int fds[3]) {
+	for(int fd=0; fd<3; fd++) {
+		if(fds[fd] != -1) close(fds[fd]);
+	}
+}
+
+/* The open() flags for each of stdin, stdout and stderr that a stage redirects, or -1 for those it
+ * leaves alone, and the file each one names. Background commands without a file or pipe of their
+ * own get /dev/null for stdin and stdout.
+ */
+const char* redirectNames[3] = { "input", "output", "error" };
+void redirectModes(struct Command* cmnd, bool background, bool piped[2], int modes[3], char* files[3]) {
+	modes[0] = cmnd->inputRedirect || (background && !piped[0]) ? O_RDONLY : -1;
+	modes[1] = cmnd->outputRedirect || (background && !piped[1]) ?
+			O_WRONLY|O_CREAT|(cmnd->appendOutput ? O_APPEND : O_TRUNC) : -1;
+	modes[2] = cmnd->errorRedirect ? O_WRONLY|O_CREAT|(cmnd->errorAppend ? O_APPEND : O_TRUNC) : -1;
+	files[0] = cmnd->inputFile;
+	files[1] = cmnd->outputFile;
+	files[2] = cmnd->errorFile;
+}
+
+/* Optional io_uring backend, MSHELL_IO=uring, for the redirect opens of a whole pipeline. Every
+ * stage's targets go in as IORING_OP_OPENAT requests, one linked chain per stage, and a single
+ * io_uring_enter() submits them all and waits for the lot, instead of an open() apiece at each
+ * launch. The chain keeps the sequential semantics: once one of a stage's targets fails the rest
+ * are cancelled, so a bad '<' still creates no '>' file. The ring is set up on first use with the
+ * raw syscalls, no liburing, and if the kernel or a seccomp filter refuses it the shell quietly
+ * stays on open().
+ */
+enum { URING_OFF, URING_WANTED, URING_READY } uringState = URING_OFF;
+struct Uring
+{
+	int fd;
+	unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned int *cqHead, *cqTail, *cqMask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+} uring;
+
+bool uringSetup() {
+	struct io_uring_params params;
+	memset(&params,0,sizeof(params));
+	uring.fd = syscall(SYS_io_uring_setup,URING_ENTRIES,&params);
+	if(uring.fd == -1) {
+		return false;
+	}
+	fcntl(uring.fd,F_SETFD,FD_CLOEXEC);
+	size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP) {
+		sqSize = cqSize = sqSize > cqSize ? sqSize : cqSize;
+	}
+	char* sq = mmap(NULL,sqSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,uring.fd,IORING_OFF_SQ_RING);
+	char* cq = sq;
+	if(sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq = mmap(NULL,cqSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,uring.fd,IORING_OFF_CQ_RING);
+	}
+	uring.sqes = mmap(NULL,params.sq_entries * sizeof(struct io_uring_sqe),PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE,uring.fd,IORING_OFF_SQES);
+	if(sq == MAP_FAILED || cq == MAP_FAILED || uring.sqes == MAP_FAILED) {
+		close(uring.fd);
+		return false;
+	}
+	uring.sqHead = (unsigned int*)(sq + params.sq_off.head);
+	uring.sqTail = (unsigned int*)(sq + params.sq_off.tail);
+	uring.sqMask = (unsigned int*)(sq + params.sq_off.ring_mask);
+	uring.sqArray = (unsigned int*)(sq + params.sq_off.array);
+	uring.cqHead = (unsigned int*)(cq + params.cq_off.head);
+	uring.cqTail = (unsigned int*)(cq + params.cq_off.tail);
+	uring.cqMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return true;
+}
+
+//Queues an openat of path, linked to the next request when link is set. user_data is the slot for the result.
+void uringOpen(char* path, int flags, bool link, int slot) {
+	unsigned int tail = *uring.sqTail;
+	unsigned int index = tail & *uring.sqMask;
+	struct io_uring_sqe* sqe = &uring.sqes[index];
+	memset(sqe,0,sizeof(*sqe));
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)path;
+	sqe->len = 0644;
+	sqe->open_flags = flags|O_CLOEXEC;
+	sqe->flags = link ? IOSQE_IO_LINK : 0;
+	sqe->user_data = slot;
+	uring.sqArray[index] = index;
+	__atomic_store_n(uring.sqTail,tail + 1,__ATOMIC_RELEASE);
+}
+
+/* Submits the count queued requests and waits for all of them, leaving each result, an fd or
+ * -errno, in results by slot. Returns false if the ring stopped working, with results whatever came.
+ */
+bool uringRun(int count, int* results) {
+	int submitted = 0, completed = 0;
+	while(completed < count) {
+		int ret = syscall(SYS_io_uring_enter,uring.fd,count - submitted,count - completed,IORING_ENTER_GETEVENTS,NULL,0);
+		if(ret == -1 && errno != EINTR) {
+			return false;
+		}
+		submitted += ret > 0 ? ret : 0;
+		unsigned int head = *uring.cqHead;
+		while(head != __atomic_load_n(uring.cqTail,__ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe* cqe = &uring.cqes[head & *uring.cqMask];
+			results[cqe->user_data] = cqe->res;
+			head++;
+			completed++;
+		}
+		__atomic_store_n(uring.cqHead,head,__ATOMIC_RELEASE);
+	}
+	return true;
+}
+
+/* Opens the redirect targets of every stage in the pipeline in one batch, before any stage starts,
+ * leaving them in each stage's redirectFds for openRedirects to pick up. Stages that feed a
+ * here-string or tee, and anything past what fits in the ring, are left to open() as before.
+ */
+void uringOpenRedirects(struct Command* cmnd, bool background) {
+	int results[URING_ENTRIES];
+	struct Command* stages[URING_ENTRIES];
+	int numStages = 0, count = 0;
+	if(uringState == URING_WANTED) {
+		uringState = uringSetup() ? URING_READY : URING_OFF;
+	}
+	if(uringState != URING_READY) {
+		return;
+	}
+	for(struct Command* stage = cmnd; stage != NULL; stage = stage->pipeNext) {
+		int modes[3];
+		char* files[3];
+		bool piped[2] = { stage != cmnd, stage->pipeNext != NULL };
+		redirectModes(stage,background,piped,modes,files);
+		int needed = (modes[0] != -1) + (modes[1] != -1) + (modes[2] != -1);
+		if(needed == 0 || stage->hereString != NULL || stage->teeFile != NULL) {
+			continue;
+		}
+		if(count + needed > URING_ENTRIES) {
+			break;
+		}
+		for(int fd=0; fd<3; fd++) {
+			stage->redirectFds[fd] = -1;
+			if(modes[fd] != -1) {
+				uringOpen(files[fd] ? files[fd] : "/dev/null",modes[fd],--needed > 0,count);
+				results[count++] = -ECANCELED;
+			}
+		}
+		stages[numStages++] = stage;
+	}
+	if(count == 0) {
+		return;
+	}
+	if(!uringRun(count,results)) {
+		//whatever did open is closed again, and every stage falls back to open().
+		for(int i=0; i<count; i++) {
+			if(results[i] >= 0) close(results[i]);
+		}
+		uringState = URING_OFF;
+		return;
+	}
+	int slot = 0;
+	for(int i=0; i<numStages; i++) {
+		struct Command* stage = stages[i];
+		int modes[3];
+		char* files[3];
+		bool piped[2] = { stage != cmnd, stage->pipeNext != NULL };
+		redirectModes(stage,background,piped,modes,files);
+		stage->redirectsOpened = true;
+		for(int fd=0; fd<3; fd++) {
+			if(modes[fd] == -1) {
+				continue;
+			}
+			int result = results[slot++];
+			if(result >= 0) {
+				stage->redirectFds[fd] = result;
+			}
+			else if(!stage->redirectsFailed) {
+				stage->redirectsFailed = true;
+				fprintf(stderr,"Unable to open %s file: %s.\n",redirectNames[fd],files[fd] ? files[fd] : "/dev/null");
+				fflush(stderr);
+			}
+		}
+		if(stage->redirectsFailed) {
+			closeRedirects(stage->redirectFds);
+			stage->redirectFds[0] = stage->redirectFds[1] = stage->redirectFds[2] = -1;
+		}
+	}
+}
+
+/* Opens everything a stage redirects to, close-on-exec so that only the copies dup'd onto 0, 1 and 2
+ * ever reach a command. fds gets the new stdin, stdout and stderr, -1 for any left alone. Returns
+ * false, with nothing left open, if a target couldn't be opened.
+ */
+bool openRedirects(struct Command* cmnd, bool background, int fds[3]) {
+	int modes[3];
+	char* files[3];
+	bool piped[2] = { cmnd->pipeIn != -1, cmnd->pipeOut != -1 };
+	if(cmnd->redirectsOpened) {
+		memcpy(fds,cmnd->redirectFds,sizeof(cmnd->redirectFds));
+		return !cmnd->redirectsFailed;
+	}
+	redirectModes(cmnd,background,piped,modes,files);
+	fds[0] = fds[1] = fds[2] = -1;
+	for(int fd=0; fd<3; fd++) {
+		if(modes[fd] != -1 && (fds[fd] = fd == 0 && cmnd->hereString != NULL ? hereStringFd(cmnd->hereString) :
+				openRedirect(files[fd],modes[fd],(char*)redirectNames[fd])) == -1) {
+			closeRedirects(fds);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Takes care of all input and output redirection for commands, in the child. Pipe ends from
+ * neighbouring pipeline stages go on first, so a file redirect on the same stage wins over the pipe,
+ * and 2>&1 goes on in source order: before the files if it came before '>', otherwise last so stderr
+ * follows stdout to wherever it ended up.
+ */
+void inputoutputRedirect(struct Command* cmnd, int fds[3]) {
+	if(cmnd->pipeIn != -1 && dup2(cmnd->pipeIn,STDIN_FILENO) == -1) {
+		perror("smallsh: cannot connect pipe input.\n");
+		fflush(stderr);
+		exit(EXIT_FAILURE);
+	}
+	if(cmnd->pipeOut != -1 && dup2(cmnd->pipeOut,STDOUT_FILENO) == -1) {
+		perror("smallsh: cannot connect pipe output.\n");
+		fflush(stderr);
+		exit(EXIT_FAILURE);
+	}
+	if(cmnd->errorBeforeOutput && dup2(STDOUT_FILENO,STDERR_FILENO) == -1) {
+		perror("smallsh: cannot redirect stderr.\n");
+		fflush(stderr);
+		exit(EXIT_FAILURE);
+	}
+	for(int fd=0; fd<3; fd++) {
+		if(fds[fd] != -1 && dup2(fds[fd],fd) == -1) {
+			perror("smallsh: cannot redirect.\n");
+			fflush(stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(cmnd->errorToOutput && dup2(STDOUT_FILENO,STDERR_FILENO) == -1) {
+		perror("smallsh: cannot redirect stderr.\n");
+		fflush(stderr);
+		exit(EXIT_FAILURE);
+	}
+}
+
+//The end of the fork and zygote children: become the command, or say why not and exit.
+void execCommand(char* path, char** args) {
+	if(path != NULL) {
+		execv(path,args);
+		//too many arguments for ARG_MAX, say, rather than a missing program.
+		if(errno != ENOENT) {
+			fprintf(stderr, "%s: %s.\n", args[0], strerror(errno));
+			fflush(stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	fprintf(stderr, "%s: no such file or directory.\n", args[0]);
+	fflush(stderr);
+	exit(EXIT_FAILURE);
+}
+
+//The command's path, after making sure a cached one is still there. Only the parent can fix the cache.
+char* commandPath(char* name) {
+	char* path = lookupCommand(name);
+	if(path != NULL && path != name && access(path,X_OK)!=0) {
+		hashForget(name);
+		path = lookupCommand(name);
+	}
+	return path;
+}
+
+/* Resource limits for launched commands, from the limit builtin or the default it sets for
+ * background jobs. With a writable cgroup v2 hierarchy each limited pipeline gets a cgroup of its
+ * own under a mshell-<pid> one made for the shell, which also gives jobs its CPU and memory use.
+ * Any limit whose controller isn't delegated to us falls back to the nearest per-process knob on
+ * each stage instead: the nice value for cpu.weight, RLIMIT_AS for memory.max and the best effort
+ * I/O priority for io.weight. A limited pipeline always takes the fork launcher, so each child can
+ * put itself under the limits between fork and exec and the command never runs without them.
+ */
+struct Limits
+{
+	long cpuWeight;			//1 to 10000, 100 is the kernel default. 0 for no limit.
+	long long memoryMax;	//bytes, 0 for no limit.
+	long ioWeight;			//1 to 10000, like cpuWeight.
+	bool pinned;			//only run on the CPUs in cpus.
+	cpu_set_t cpus;
+	bool numa;				//give each job the next NUMA node's CPUs and memory, in turn.
+};
+//Where one pipeline runs: the CPUs its stages are pinned to, and the node they prefer, if any.
+struct Placement
+{
+	bool pinned;
+	cpu_set_t cpus;
+	int node;				//-1 for no memory policy.
+};
+struct Placement launchPlacement;
+int numNodes = -1;					//-1 until the topology has been read.
+int nodeIds[MAX_NODES];
+cpu_set_t nodeCpus[MAX_NODES];
+int nextNode = 0;
+struct Limits backgroundLimits;			//the default for background jobs.
+struct Limits* commandLimits = NULL;	//set by limit while it runs its command.
+struct Limits* launchLimits = NULL;		//what the pipeline being started gets, and its cgroup.
+char* launchCgroup = NULL;
+enum { CONTROL_CPU, CONTROL_MEMORY, CONTROL_IO, NUM_CONTROLS };
+const char* controlNames[NUM_CONTROLS] = { "cpu", "memory", "io" };
+bool cgroupControls[NUM_CONTROLS];	//controllers our cgroups can use.
+char* cgroupSlice = NULL;			//the shell's own cgroup, NULL if there isn't one.
+bool cgroupTried = false;
+unsigned long cgroupCount = 0;
+
+//True if a space separated controller list, as in cgroup.controllers, has name in it.
+bool hasControl(const char* list, const char* name) {
+	size_t length = strlen(name);
+	for(const char* found = strstr(list,name); found != NULL; found = strstr(found + 1,name)) {
+		if((found == list || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\n' || found[length] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Removes what earlier shells left under base: the cgroups of jobs that outlived them, once those
+ * are empty, the leaf the shell itself sat in, and then their own. A shell that's still running
+ * keeps its cgroups.
+ */
+void cgroupSweep(const char* base) {
+	char path[MAX_PATH + 64];
+	DIR* dir = opendir(base);
+	struct dirent* entry;
+	while(dir != NULL && (entry = readdir(dir)) != NULL) {
+		int pid;
+		if(sscanf(entry->d_name,"mshell-%d",&pid) != 1 || (kill(pid,0) == 0 || errno != ESRCH)) {
+			continue;
+		}
+		snprintf(path,sizeof(path),"%s/%s",base,entry->d_name);
+		DIR* jobsDir = opendir(path);
+		struct dirent* job;
+		while(jobsDir != NULL && (job = readdir(jobsDir)) != NULL) {
+			char jobPath[sizeof(path) + 256];
+			if(strncmp(job->d_name,"job-",4)==0 || strcmp(job->d_name,"shell")==0) {
+				snprintf(jobPath,sizeof(jobPath),"%s/%s",path,job->d_name);
+				rmdir(jobPath);
+			}
+		}
+		if(jobsDir != NULL) {
+			closedir(jobsDir);
+		}
+		rmdir(path);
+	}
+	if(dir != NULL) {
+		closedir(dir);
+	}
+}
+
+/* Finds where the shell sits in the cgroup v2 hierarchy: own, its path under the mount, base, the
+ * full path, and in available the controllers base has. Only reads. Returns false if there's no
+ * cgroup2 mount or the shell's cgroup in it can't be read.
+ */
+bool cgroupFind(char own[MAX_PATH], char* base, size_t baseSize, char* available, size_t availableSize) {
+	char mount[MAX_PATH] = "", path[2 * MAX_PATH + 32], list[256];
+	FILE* mounts = fopen("/proc/self/mountinfo","re");
+	char* line = NULL;
+	size_t lineSize = 0;
+	while(mounts != NULL && getline(&line,&lineSize,mounts) != -1) {
+		//id parent major:minor root mountpoint options... - type source options
+		char point[MAX_PATH];
+		char* dash = strstr(line," - cgroup2 ");
+		if(dash != NULL && sscanf(line,"%*s %*s %*s %*s %4095s",point) == 1) {
+			strcpy(mount,point);
+			break;
+		}
+	}
+	free(line);
+	if(mounts != NULL) {
+		fclose(mounts);
+	}
+	if(mount[0] == '\0' || !readFile("/proc/self/cgroup",list,sizeof(list))) {
+		return false;
+	}
+	//the v2 entry is the one with hierarchy 0 and no controllers: 0::/path.
+	char* entry = strstr(list,"0::");
+	if(entry == NULL || (entry != list && entry[-1] != '\n') || sscanf(entry + 3,"%4095s",own) != 1) {
+		return false;
+	}
+	snprintf(base,baseSize,"%s%s",mount,strcmp(own,"/")==0 ? "" : own);
+	snprintf(path,sizeof(path),"%s/cgroup.controllers",base);
+	return readFile(path,available,availableSize);
+}
+
+/* Makes the cgroup the shell's limited jobs go under, the first time one is launched. Outside the
+ * root, a cgroup with processes of its own
+ * can't hand controllers down, so the shell first moves itself into a leaf, shell, of its new
+ * cgroup. That leaf can't go until the shell does, so the next shell's sweep removes it. Then the
+ * controllers the parent has are turned on for the new cgroup, with a note for any that won't
+ * go on; those, and everything when there's no cgroup2 mount we can write to, go through the
+ * fallbacks instead.
+ */
+void cgroupSetup() {
+	char own[MAX_PATH] = "", base[2 * MAX_PATH], path[2 * MAX_PATH + 32], list[256], available[256];
+	cgroupTried = true;
+	if(!cgroupFind(own,base,sizeof(base),available,sizeof(available))) {
+		return;
+	}
+	cgroupSweep(base);
+	snprintf(path,sizeof(path),"%s/mshell-%d",base,(int)getpid());
+	if(mkdir(path,0755) == -1 && errno != EEXIST) {
+		return;
+	}
+	cgroupSlice = xstrdup(path);
+	if(strcmp(own,"/") != 0) {
+		snprintf(path,sizeof(path),"%s/shell",cgroupSlice);
+		mkdir(path,0755);
+		snprintf(path,sizeof(path),"%s/shell/cgroup.procs",cgroupSlice);
+		writeFile(path,"0");
+	}
+	snprintf(path,sizeof(path),"%s/cgroup.subtree_control",base);
+	for(int i=0; i<NUM_CONTROLS; i++) {
+		char enable[16];
+		snprintf(enable,sizeof(enable),"+%s",controlNames[i]);
+		if(hasControl(available,controlNames[i])) {
+			writeFile(path,enable);
+		}
+	}
+	if(!readFile(path,list,sizeof(list))) {
+		list[0] = '\0';
+	}
+	snprintf(path,sizeof(path),"%s/cgroup.subtree_control",cgroupSlice);
+	for(int i=0; i<NUM_CONTROLS; i++) {
+		char enable[16];
+		snprintf(enable,sizeof(enable),"+%s",controlNames[i]);
+		cgroupControls[i] = hasControl(list,controlNames[i]) && writeFile(path,enable);
+		if(!cgroupControls[i] && hasControl(available,controlNames[i])) {
+			fprintf(stderr,"smallsh: limit: can't enable the cgroup %s controller, using the fallback.\n",controlNames[i]);
+			fflush(stderr);
+		}
+	}
+}
+
+//Takes the shell's cgroup down on the way out. Jobs still in theirs keep it, and it, alive.
+void cgroupCleanup() {
+	if(cgroupSlice != NULL) {
+		rmdir(cgroupSlice);
+	}
+}
+
+/* Makes the cgroup for one limited pipeline and writes its limits into it. Returns its heap path,
+ * or NULL to have every limit done with the fallbacks.
+ */
+char* cgroupCreate(struct Limits* limits) {
+	char path[MAX_PATH + 32], value[32];
+	if(!cgroupTried) {
+		cgroupSetup();
+	}
+	if(cgroupSlice == NULL) {
+		return NULL;
+	}
+	snprintf(path,sizeof(path),"%s/job-%lu",cgroupSlice,++cgroupCount);
+	if(mkdir(path,0755) == -1) {
+		return NULL;
+	}
+	char* cgroup = xstrdup(path);
+	if(limits->cpuWeight && cgroupControls[CONTROL_CPU]) {
+		snprintf(path,sizeof(path),"%s/cpu.weight",cgroup);
+		snprintf(value,sizeof(value),"%ld",limits->cpuWeight);
+		writeFile(path,value);
+	}
+	if(limits->memoryMax && cgroupControls[CONTROL_MEMORY]) {
+		snprintf(path,sizeof(path),"%s/memory.max",cgroup);
+		snprintf(value,sizeof(value),"%lld",limits->memoryMax);
+		writeFile(path,value);
+	}
+	if(limits->ioWeight && cgroupControls[CONTROL_IO]) {
+		snprintf(path,sizeof(path),"%s/io.weight",cgroup);
+		snprintf(value,sizeof(value),"default %ld",limits->ioWeight);
+		writeFile(path,value);
+	}
+	return cgroup;
+}
+
+/* Parses a CPU list the way the kernel writes them, "0-3,8,10-11", into set. Returns false if it
+ * isn't one or names no CPUs.
+ */
+bool parseCpuList(const char* list, cpu_set_t* set) {
+	CPU_ZERO(set);
+	while(*list != '\0' && *list != '\n') {
+		char* end;
+		long first = strtol(list,&end,10), last = first;
+		if(end == list || first < 0) {
+			return false;
+		}
+		if(*end == '-') {
+			list = end + 1;
+			last = strtol(list,&end,10);
+			if(end == list || last < first) {
+				return false;
+			}
+		}
+		for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+			CPU_SET(cpu,set);
+		}
+		if(*end == ',') {
+			end++;
+		}
+		else if(*end != '\0' && *end != '\n') {
+			return false;
+		}
+		list = end;
+	}
+	return CPU_COUNT(set) > 0;
+}
+
+//Writes a CPU set back out as a list, with runs as ranges.
+void formatCpuList(cpu_set_t* set, char* buf, size_t size) {
+	size_t used = 0;
+	buf[0] = '\0';
+	for(int cpu=0; cpu<CPU_SETSIZE && used < size; cpu++) {
+		if(!CPU_ISSET(cpu,set)) {
+			continue;
+		}
+		int last = cpu;
+		while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1,set)) {
+			last++;
+		}
+		used += snprintf(buf + used,size - used,last == cpu ? "%s%d" : "%s%d-%d",used ? "," : "",cpu,last);
+		cpu = last;
+	}
+}
+
+/* Reads which NUMA nodes there are and their CPUs, once. Without sysfs there are none. Node ids
+ * from MAX_NODES up are left out, since limitSelf's memory policy mask only has room below that.
+ */
+void numaTopology() {
+	char path[64], list[1024];
+	cpu_set_t online;
+	numNodes = 0;
+	if(!readFile("/sys/devices/system/node/online",list,sizeof(list)) || !parseCpuList(list,&online)) {
+		return;
+	}
+	for(int node=0; node<MAX_NODES; node++) {
+		snprintf(path,sizeof(path),"/sys/devices/system/node/node%d/cpulist",node);
+		if(CPU_ISSET(node,&online) && readFile(path,list,sizeof(list)) && parseCpuList(list,&nodeCpus[numNodes])) {
+			nodeIds[numNodes++] = node;
+		}
+	}
+}
+
+/* Works out where the next job goes. --numa takes the nodes round robin, skipping any with none
+ * of the --cpus, and pins the job to the node's CPUs with its memory preferred there.
+ */
+void placeJob(struct Limits* limits, struct Placement* place) {
+	place->pinned = limits->pinned;
+	place->cpus = limits->cpus;
+	place->node = -1;
+	if(!limits->numa) {
+		return;
+	}
+	if(numNodes == -1) {
+		numaTopology();
+	}
+	for(int tries=0; tries<numNodes; tries++) {
+		int node = nextNode;
+		nextNode = (nextNode + 1) % numNodes;
+		cpu_set_t cpus = nodeCpus[node];
+		if(limits->pinned) {
+			CPU_AND(&cpus,&cpus,&limits->cpus);
+		}
+		if(CPU_COUNT(&cpus) > 0) {
+			place->pinned = true;
+			place->cpus = cpus;
+			place->node = nodeIds[node];
+			return;
+		}
+	}
+}
+
+//How a placement reads in the job table: "node 1, cpus 8-15". NULL if the job wasn't placed.
+char* describePlacement(struct Placement* place) {
+	char cpus[256], text[300];
+	if(!place->pinned) {
+		return NULL;
+	}
+	formatCpuList(&place->cpus,cpus,sizeof(cpus));
+	if(place->node >= 0) {
+		snprintf(text,sizeof(text),"node %d, cpus %s",place->node,cpus);
+	}
+	else {
+		snprintf(text,sizeof(text),"cpus %s",cpus);
+	}
+	return xstrdup(text);
+}
+
+/* Parses --cpus list and --numa, for limit and parallel, from args[i]. Returns how many arguments
+ * it took, 0 if args[i] isn't one of them, or -1 after complaining about a bad CPU list.
+ */
+int placementOption(char** args, int i, struct Limits* limits) {
+	if(strcmp(args[i],"--numa")==0) {
+		limits->numa = true;
+		return 1;
+	}
+	if(strcmp(args[i],"--cpus")!=0) {
+		return 0;
+	}
+	if(args[i + 1] == NULL || !parseCpuList(args[i + 1],&limits->cpus)) {
+		fprintf(stderr,"smallsh: %s: --cpus needs a CPU list like 0-3,8.\n",args[0]);
+		fflush(stderr);
+		return -1;
+	}
+	limits->pinned = true;
+	return 2;
+}
+
+/* Puts the calling process, a freshly forked stage, under its limits: into the pipeline's cgroup
+ * if it has one, and through the per-process fallbacks for the limits the cgroup can't enforce.
+ * Then it's pinned to the placement's CPUs, with its memory preferred on its node where the
+ * kernel has NUMA support.
+ */
+void limitSelf(struct Limits* limits, char* cgroup, struct Placement* place) {
+	char path[MAX_PATH + 32];
+	if(place->pinned) {
+		sched_setaffinity(0,sizeof(cpu_set_t),&place->cpus);
+	}
+	if(place->node >= 0) {
+		unsigned long nodes[MAX_NODES / (8 * sizeof(unsigned long)) + 1] = { 0 };
+		nodes[place->node / (8 * sizeof(unsigned long))] |= 1UL << place->node % (8 * sizeof(unsigned long));
+		syscall(SYS_set_mempolicy,1,nodes,sizeof(nodes) * 8);	//MPOL_PREFERRED.
+	}
+	if(cgroup != NULL) {
+		snprintf(path,sizeof(path),"%s/cgroup.procs",cgroup);
+		//0 is whoever writes it.
+		if(!writeFile(path,"0")) {
+			cgroup = NULL;
+		}
+	}
+	//each nice level is about a 1.25 times smaller share, from 100 at nice 0.
+	if(limits->cpuWeight && (cgroup == NULL || !cgroupControls[CONTROL_CPU])) {
+		int nice = 0;
+		for(double weight = 100; weight > limits->cpuWeight * 1.12 && nice < 19; weight /= 1.25) {
+			nice++;
+		}
+		for(double weight = 100; weight < limits->cpuWeight / 1.12 && nice > -20; weight *= 1.25) {
+			nice--;
+		}
+		setpriority(PRIO_PROCESS,0,nice);
+	}
+	if(limits->memoryMax && (cgroup == NULL || !cgroupControls[CONTROL_MEMORY])) {
+		struct rlimit memory = { limits->memoryMax, limits->memoryMax };
+		setrlimit(RLIMIT_AS,&memory);
+	}
+	//best effort I/O priority 4 is the default; each level up or down doubles or halves the weight.
+	if(limits->ioWeight && (cgroup == NULL || !cgroupControls[CONTROL_IO])) {
+		int level = 4;
+		for(long weight = 100; weight > limits->ioWeight * 3 / 2 && level < 7; weight /= 2) {
+			level++;
+		}
+		for(long weight = 100; weight * 3 / 2 < limits->ioWeight && level > 0; weight *= 2) {
+			level--;
+		}
+		syscall(SYS_ioprio_set,1,0,2 << 13 | level);	//IOPRIO_WHO_PROCESS, IOPRIO_CLASS_BE.
+	}
+}
+
+//True if any limit a cgroup would enforce is set.
+bool hasLimits(struct Limits* limits) {
+	return limits->cpuWeight || limits->memoryMax || limits->ioWeight;
+}
+
+bool hasPlacement(struct Limits* limits) {
+	return limits->pinned || limits->numa;
+}
+
+#define TEE_CHUNK 65536
+
+//write() until all of it is out. False on an error.
+bool writeAll(int fd, const char* buf, size_t length) {
+	while(length > 0) {
+		ssize_t written = write(fd,buf,length);
+		if(written == -1 && errno == EINTR) {
+			continue;
+		}
+		if(written <= 0) {
+			return false;
+		}
+		buf += written;
+		length -= written;
+	}
+	return true;
+}
+
+//Moves length bytes from a pipe into a file with splice(), or through buf if the file can't take that.
+bool spliceAll(int in, int file, size_t length, char* buf) {
+	while(length > 0) {
+		ssize_t moved = splice(in,NULL,file,NULL,length,SPLICE_F_MOVE);
+		if(moved == -1 && errno == EINVAL) {
+			moved = read(in,buf,length < TEE_CHUNK ? length : TEE_CHUNK);
+			if(moved > 0 && !writeAll(file,buf,moved)) {
+				return false;
+			}
+		}
+		if(moved == -1 && errno == EINTR) {
+			continue;
+		}
+		if(moved <= 0) {
+			return false;
+		}
+		length -= moved;
+	}
+	return true;
+}
+
+/* The loop a tee stage runs. tee(2) copies what's waiting in the input pipe into the output pipe
+ * without using it up, then splice(2) moves the same bytes into the file, so the data never comes
+ * up into userspace. When stdout can't take a tee, a terminal say, it goes back to read and write.
+ * Returns the exit status.
+ */
+int teeLoop(int file) {
+	char buf[TEE_CHUNK];
+	bool zeroCopy = true;
+	while(1) {
+		ssize_t length;
+		if(zeroCopy) {
+			length = tee(STDIN_FILENO,STDOUT_FILENO,TEE_CHUNK,0);
+			if(length == -1 && errno == EINVAL) {
+				zeroCopy = false;
+				continue;
+			}
+		}
+		else {
+			length = read(STDIN_FILENO,buf,sizeof(buf));
+			if(length > 0 && !writeAll(STDOUT_FILENO,buf,length)) {
+				return 1;
+			}
+		}
+		if(length == -1 && errno == EINTR) {
+			continue;
+		}
+		if(length <= 0) {
+			return length == 0 ? 0 : 1;
+		}
+		//the output has its copy. A tee leaves the bytes in the input for the file to take.
+		if(zeroCopy ? !spliceAll(STDIN_FILENO,file,length,buf) : !writeAll(file,buf,length)) {
+			return 1;
+		}
+	}
+}
+
+void forkedCopyClose();
+
+//Starts a tee stage: a forked copy of the shell running teeLoop between the pipes around it.
+pid_t teeCommand(struct Command* cmnd, bool background, pid_t pgid) {
+	int file = openRedirect(cmnd->teeFile,O_WRONLY|O_CREAT|O_TRUNC,"output");
+	if(file == -1) {
+		return -1;
+	}
+	int fds[3] = { -1, -1, -1 };
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == -1) {
+		perror("smallsh: fork");
+		fflush(stderr);
+	}
+	else if(pid == 0) {
+		signal(SIGTSTP,SIG_IGN);
+		if(background) {
+			setpgid(0,pgid);
+		}
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK,&mask,NULL);
+		if(!background) {
+			sigintDefault();
+		}
+		inputoutputRedirect(cmnd,fds);
+		forkedCopyClose();
+		_exit(teeLoop(file));
+	}
+	close(file);
+	if(pid > 0 && background) {
+		setpgid(pid,pgid ? pgid : pid);
+	}
+	return pid;
+}
+
+//Original launcher: fork, fix up the child's signals and redirects, then exec. Returns the child pid.
+pid_t forkCommand(struct Command* cmnd, bool background, pid_t pgid) {
+	char* path = commandPath(cmnd->args[0]);
+	//redirect targets are opened here, so a bad one stops the command before there's a child.
+	int fds[3];
+	if(!openRedirects(cmnd,background,fds)) {
+		return -1;
+	}
+	//when tracing, a close-on-exec pipe tells the parent the moment the child execs.
+	int execPipe[2] = { -1, -1 };
+	if(traceFd != -1 && pipe2(execPipe,O_CLOEXEC) == -1) {
+		execPipe[0] = execPipe[1] = -1;
+	}
+	pid_t childPid = fork();
+	switch(childPid) {
+		//fork error.
+		case(-1): {
+					perror("Hull Breach!\n");
+					exit(1);
+				}
+		//in the child process.
+		case(0): {
+
+					signal(SIGTSTP,SIG_IGN);
+					if(background) {
+						setpgid(0,pgid);
+					}
+					//the shell blocks SIGCHLD for its signalfd, the command shouldn't inherit that.
+					sigset_t mask;
+					sigemptyset(&mask);
+					sigprocmask(SIG_SETMASK,&mask,NULL);
+					//if the process is foreground, enable SIGINT.
+					if(!background) {
+						sigintDefault();
+					}
+					inputoutputRedirect(cmnd,fds);
+					if(launchLimits != NULL) {
+						limitSelf(launchLimits,launchCgroup,&launchPlacement);
+					}
+					//execute.
+					execCommand(path,cmnd->args);
+				}
+	}
+	closeRedirects(fds);
+	//set the group from both sides so it's in place whichever of us runs first.
+	if(background) {
+		setpgid(childPid,pgid ? pgid : childPid);
+	}
+	if(execPipe[0] != -1) {
+		char byte;
+		close(execPipe[1]);
+		while(read(execPipe[0],&byte,1) == -1 && errno == EINTR) {}
+		close(execPipe[0]);
+	}
+	return childPid;
+}
+
+/* posix_spawn launcher. The parent doesn't copy its page tables, so the cost of starting a command
+ * stays flat as the shell grows. Redirect files are opened here and handed to the child as dup2
+ * file actions, and the child's signal setup is done through spawn attributes: SIGINT back to
+ * default for foreground commands, and SIGTSTP blocked, since spawn has no way to ask for SIG_IGN.
+ * Returns the child pid, or -1 if the command couldn't be started.
+ */
+pid_t spawnCommand(struct Command* cmnd, bool background, pid_t pgid) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask, defaults;
+	int fds[3];
+	pid_t childPid = -1;
+	int err;
+
+	if(!openRedirects(cmnd,background,fds)) {
+		return -1;
+	}
+	//file actions run in order, so 2>&1 lands before or after stdout's file, same as the fork path.
+	posix_spawn_file_actions_init(&actions);
+	int ifile = fds[0] != -1 ? fds[0] : cmnd->pipeIn;
+	int ofile = fds[1] != -1 ? fds[1] : cmnd->pipeOut;
+	if(ifile != -1) posix_spawn_file_actions_adddup2(&actions,ifile,STDIN_FILENO);
+	if(cmnd->errorBeforeOutput) {
+		int efile = cmnd->pipeOut != -1 ? cmnd->pipeOut : STDOUT_FILENO;
+		posix_spawn_file_actions_adddup2(&actions,efile,STDERR_FILENO);
+	}
+	if(ofile != -1) posix_spawn_file_actions_adddup2(&actions,ofile,STDOUT_FILENO);
+	if(fds[2] != -1) posix_spawn_file_actions_adddup2(&actions,fds[2],STDERR_FILENO);
+	if(cmnd->errorToOutput) posix_spawn_file_actions_adddup2(&actions,STDOUT_FILENO,STDERR_FILENO);
+
+	posix_spawnattr_init(&attr);
+	sigemptyset(&mask);
+	sigaddset(&mask,SIGTSTP);
+	posix_spawnattr_setsigmask(&attr,&mask);
+	sigemptyset(&defaults);
+	if(!background) {
+		sigaddset(&defaults,SIGINT);
+	}
+	posix_spawnattr_setsigdefault(&attr,&defaults);
+	posix_spawnattr_setpgroup(&attr,pgid);
+	posix_spawnattr_setflags(&attr,POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF|
+			(background ? POSIX_SPAWN_SETPGROUP : 0));
+
+	char* path = lookupCommand(cmnd->args[0]);
+	err = path ? posix_spawn(&childPid,path,&actions,&attr,cmnd->args,environ) : ENOENT;
+	//a cached path that stopped existing gets dropped and searched for again.
+	if(err == ENOENT && path != NULL && strchr(cmnd->args[0],'/') == NULL) {
+		hashForget(cmnd->args[0]);
+		path = lookupCommand(cmnd->args[0]);
+		err = path ? posix_spawn(&childPid,path,&actions,&attr,cmnd->args,environ) : ENOENT;
+	}
+	if(err != 0) {
+		if(err == ENOENT) {
+			fprintf(stderr, "%s: no such file or directory.\n", cmnd->args[0]);
+		}
+		else {
+			fprintf(stderr, "%s: %s.\n", cmnd->args[0], strerror(err));
+		}
+		fflush(stderr);
+		childPid = -1;
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	//pipe ends belong to launchPipeline, only close the files opened here.
+	closeRedirects(fds);
+	return childPid;
+}
+
+/* Zygote launcher, for MSHELL_LAUNCHER=zygote. A few helpers are forked ahead of time with their
+ * signals already set up the way the fork path's child does it, and each one waits on a socket.
+ * Starting a command sends a helper the path and argv with the stdin, stdout and stderr to use as
+ * SCM_RIGHTS, and the helper execs straight away, so the fork happens while the previous command
+ * runs instead of on the way to this one. A helper is the shell's child, so the command it becomes
+ * is waited for like any other. Helpers keep the cwd and environment they were forked with, so cd
+ * drains the pool and it fills again on the next launch.
+ */
+#define ZYGOTE_POOL 4
+
+struct Zygote {
+	pid_t pid;
+	int sock;					//the shell's end; the helper execs or exits when it closes.
+};
+struct Zygote zygotes[ZYGOTE_POOL];
+int numZygotes = 0;
+
+//Sent ahead of the strings, which are the path and then each argument, all null terminated.
+struct ZygoteRequest {
+	pid_t pgid;
+	bool background;
+	bool errorToOutput;
+	int numArgs;
+	size_t length;				//bytes of strings that follow.
+	int targets[3];				//the fd each passed descriptor goes on, in the order sent.
+	int numFds;
+};
+
+bool readAll(int fd, void* buf, size_t length) {
+	for(size_t done = 0; done < length;) {
+		ssize_t n = read(fd,(char*)buf + done,length - done);
+		if(n <= 0 && !(n == -1 && errno == EINTR)) {
+			return false;
+		}
+		done += n > 0 ? n : 0;
+	}
+	return true;
+}
+
+bool sendAll(int fd, const void* buf, size_t length) {
+	for(size_t done = 0; done < length;) {
+		ssize_t n = send(fd,(const char*)buf + done,length - done,MSG_NOSIGNAL);
+		if(n == -1 && errno != EINTR) {
+			return false;
+		}
+		done += n > 0 ? n : 0;
+	}
+	return true;
+}
+
+//A helper's whole life: wait for one command, then become it. The shell closing the socket ends it.
+void zygoteMain(int sock) {
+	struct ZygoteRequest request;
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct iovec part = { &request, sizeof(request) };
+	struct msghdr msg = { .msg_iov = &part, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+	int fds[3];
+	if(recvmsg(sock,&msg,MSG_CMSG_CLOEXEC) != sizeof(request)) {
+		_exit(0);
+	}
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if(request.numFds > 0) {
+		if(cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+			_exit(EXIT_FAILURE);
+		}
+		memcpy(fds,CMSG_DATA(cmsg),request.numFds * sizeof(int));
+	}
+	char* strings = malloc(request.length);
+	char** args = malloc((request.numArgs + 1) * sizeof(char*));
+	if(strings == NULL || args == NULL || !readAll(sock,strings,request.length)) {
+		_exit(EXIT_FAILURE);
+	}
+	char* str = strings + strlen(strings) + 1;
+	for(int i=0; i<request.numArgs; i++, str += strlen(str) + 1) {
+		args[i] = str;
+	}
+	args[request.numArgs] = NULL;
+	if(request.background) {
+		setpgid(0,request.pgid);
+	}
+	else {
+		sigintDefault();
+	}
+	for(int i=0; i<request.numFds; i++) {
+		if(dup2(fds[i],request.targets[i]) == -1) {
+			perror("smallsh: cannot redirect.\n");
+			_exit(EXIT_FAILURE);
+		}
+	}
+	if(request.errorToOutput) {
+		dup2(STDOUT_FILENO,STDERR_FILENO);
+	}
+	execCommand(strings[0] ? strings : NULL,args);
+}
+
+//Tops the pool back up. Helpers idle with SIGINT still ignored, since ^C reaches them too.
+void zygoteFill() {
+	while(numZygotes < ZYGOTE_POOL) {
+		int sv[2];
+		if(socketpair(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0,sv) == -1) {
+			return;
+		}
+		//anything still buffered would be written twice.
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid = fork();
+		if(pid == -1) {
+			close(sv[0]);
+			close(sv[1]);
+			return;
+		}
+		if(pid == 0) {
+			//the other helpers' sockets would keep them from seeing the shell hang up.
+			for(int i=0; i<numZygotes; i++) {
+				close(zygotes[i].sock);
+			}
+			close(sv[0]);
+			signal(SIGTSTP,SIG_IGN);
+			sigset_t mask;
+			sigemptyset(&mask);
+			sigprocmask(SIG_SETMASK,&mask,NULL);
+			zygoteMain(sv[1]);
+		}
+		close(sv[1]);
+		zygotes[numZygotes].pid = pid;
+		zygotes[numZygotes].sock = sv[0];
+		numZygotes++;
+	}
+}
+
+//Sends every helper away. They exit when their socket closes and get reaped like any child.
+void zygoteDrain() {
+	while(numZygotes > 0) {
+		close(zygotes[--numZygotes].sock);
+	}
+}
+
+/* Hands a command to a helper. Returns its pid, or -1 with a message if the command couldn't be
+ * started, and -2 when there's no helper to take it so another launcher should.
+ */
+pid_t zygoteCommand(struct Command* cmnd, bool background, pid_t pgid) {
+	if(numZygotes == 0) {
+		return -2;
+	}
+	char* path = commandPath(cmnd->args[0]);
+	int fds[3];
+	if(!openRedirects(cmnd,background,fds)) {
+		return -1;
+	}
+	struct ZygoteRequest request = { pgid, background, cmnd->errorToOutput, cmnd->numArgs, 0, { 0 }, 0 };
+	int sent[3];
+	int sources[3] = { fds[0] != -1 ? fds[0] : cmnd->pipeIn, fds[1] != -1 ? fds[1] : cmnd->pipeOut, fds[2] };
+	if(cmnd->errorBeforeOutput) {
+		sources[2] = cmnd->pipeOut != -1 ? cmnd->pipeOut : STDOUT_FILENO;
+	}
+	for(int fd=0; fd<3; fd++) {
+		if(sources[fd] != -1) {
+			request.targets[request.numFds] = fd;
+			sent[request.numFds++] = sources[fd];
+		}
+	}
+	const char* target = path != NULL ? path : "";
+	size_t pathLength = strlen(target) + 1;
+	request.length = pathLength;
+	for(int i=0; i<cmnd->numArgs; i++) {
+		request.length += strlen(cmnd->args[i]) + 1;
+	}
+	char* strings = arenaAlloc(request.length);
+	char* str = strings;
+	memcpy(str,target,pathLength);
+	str += pathLength;
+	for(int i=0; i<cmnd->numArgs; i++) {
+		size_t length = strlen(cmnd->args[i]) + 1;
+		memcpy(str,cmnd->args[i],length);
+		str += length;
+	}
+
+	struct Zygote zygote = zygotes[--numZygotes];
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct iovec part = { &request, sizeof(request) };
+	struct msghdr msg = { .msg_iov = &part, .msg_iovlen = 1 };
+	if(request.numFds > 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(request.numFds * sizeof(int));
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(request.numFds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg),sent,request.numFds * sizeof(int));
+	}
+	bool handedOff = sendmsg(zygote.sock,&msg,MSG_NOSIGNAL) == sizeof(request) &&
+			sendAll(zygote.sock,strings,request.length);
+	//fds the io_uring pass opened are only there once, so if the helper didn't take them they stay
+	//open for the launcher that takes over.
+	if(handedOff || !cmnd->redirectsOpened) {
+		closeRedirects(fds);
+	}
+	if(!handedOff) {
+		//the helper died on us. Let it go and start the command some other way.
+		close(zygote.sock);
+		return -2;
+	}
+	if(background) {
+		setpgid(zygote.pid,pgid ? pgid : zygote.pid);
+	}
+	//the helper's end of the socket is close-on-exec, so end of file means it has exec'd.
+	if(traceFd != -1) {
+		char byte;
+		while(read(zygote.sock,&byte,1) == -1 && errno == EINTR) {}
+	}
+	close(zygote.sock);
+	return zygote.pid;
+}
+
+/* Brings environ up to date with the exported variables before a launch. Nothing happens unless
+ * one of them changed since the last rebuild; when one did, the helpers are sent away too, since
+ * they were forked with the old environ.
+ */
+void environUpdate() {
+	if(!environDirty) {
+		return;
+	}
+	char** env = xmalloc((numExported + 1) * sizeof(char*));
+	int count = 0;
+	for(int i=0; i<VAR_BUCKETS; i++) {
+		for(struct Variable* var = variables[i]; var != NULL; var = var->next) {
+			if(var->exported) {
+				env[count++] = var->entry;
+			}
+		}
+	}
+	env[count] = NULL;
+	free(shellEnviron);
+	shellEnviron = environ = env;
+	while(retiredVariables != NULL) {
+		struct Variable* old = retiredVariables;
+		retiredVariables = old->next;
+		free(old->entry);
+		free(old);
+	}
+	environDirty = false;
+	zygoteDrain();
+}
+
+/* Starts every stage of a pipeline before waiting on any of them, with each stage's stdout wired to
+ * the next stage's stdin through a close-on-exec pipe. A foreground pipeline runs in the shell's
+ * process group, so ^C from the terminal reaches the whole pipeline at once and ^Z still reaches the
+ * shell; a background one gets a group of its own, led by its first stage. Each stage that started
+ * is in the job table under its pid, stages that didn't have a pid of -1.
+ */
+void startPipeline(struct Command* cmnd, bool background) {
+	struct Command* stage;
+	pid_t pgid = 0;
+	int fds[2];
+	struct Limits* limits = commandLimits ? commandLimits : background ? &backgroundLimits : NULL;
+	char* cgroup = NULL;
+	bool placed = false;
+	environUpdate();
+	char* placement = NULL;
+	enum Launcher launch = launcher;
+	if(limits != NULL && (hasLimits(limits) || hasPlacement(limits))) {
+		if(hasLimits(limits)) {
+			cgroup = cgroupCreate(limits);
+		}
+		placeJob(limits,&launchPlacement);
+		placement = describePlacement(&launchPlacement);
+		launch = LAUNCH_FORK;
+	}
+	else {
+		limits = NULL;
+	}
+	launchLimits = limits;
+	launchCgroup = cgroup;
+	if(uringState != URING_OFF) {
+		uringOpenRedirects(cmnd,background);
+	}
+	for(stage = cmnd; stage != NULL; stage = stage->pipeNext) {
+		if(stage->pipeNext != NULL) {
+			if(pipe2(fds,O_CLOEXEC) == -1) {
+				perror("smallsh: pipe");
+				fflush(stderr);
+				stage->pid = -1;
+				break;
+			}
+			stage->pipeOut = fds[1];
+			stage->pipeNext->pipeIn = fds[0];
+		}
+		struct timespec launchStart;
+		if(traceFd != -1) {
+			clock_gettime(CLOCK_MONOTONIC,&launchStart);
+		}
+		stage->pid = stage->teeFile != NULL ? teeCommand(stage,background,pgid) :
+				launch == LAUNCH_ZYGOTE ? zygoteCommand(stage,background,pgid) : -2;
+		if(stage->pid == -2) {
+			stage->pid = launch == LAUNCH_FORK ? forkCommand(stage,background,pgid) : spawnCommand(stage,background,pgid);
+		}
+		if(traceFd != -1 && stage->pid != -1) {
+			dprintf(traceFd,"exec\t%d\t%ld\t%s\n",stage->pid,nanosSince(&launchStart),stage->args[0]);
+		}
+		if(stage->pid != -1) {
+			if(background && pgid == 0) {
+				pgid = stage->pid;
+			}
+			struct Job* job = addJob(stage->pid,pgid,background,cmnd->rawCommand);
+			job->cgroup = cgroup ? xstrdup(cgroup) : NULL;
+			job->placement = placement ? xstrdup(placement) : NULL;
+			placed = true;
+		}
+		//the parent's copies of the pipe ends are done with once the stage has its own.
+		if(stage->pipeIn != -1) close(stage->pipeIn);
+		if(stage->pipeOut != -1) close(stage->pipeOut);
+	}
+	//a pipe failure leaves the rest of the pipeline unlaunched, the failed stage included.
+	if(stage != NULL) {
+		for(; stage != NULL; stage = stage->pipeNext) {
+			if(stage->pipeIn != -1) close(stage->pipeIn);
+			if(stage->redirectsOpened) closeRedirects(stage->redirectFds);
+			stage->pid = -1;
+		}
+	}
+	launchLimits = NULL;
+	free(placement);
+	//the jobs have their own copies, and the last of them removes it. Without any it goes now.
+	if(cgroup != NULL) {
+		if(!placed) {
+			rmdir(cgroup);
+		}
+		free(cgroup);
+	}
+}
+
+//Runs a pipeline. Waits for it in the foreground and leaves the status of its last stage in exitStatus.
+void launchPipeline(struct Command* cmnd, int* exitStatus) {
+	bool background = cmnd->backgroundProcess && allowBackground;
+	struct Command* stage;
+	startPipeline(cmnd,background);
+	//refill while the pipeline runs, which is what keeps fork off the way to the next command.
+	if(launcher == LAUNCH_ZYGOTE) {
+		zygoteFill();
+	}
+	for(stage = cmnd; stage != NULL; stage = stage->pipeNext) {
+		int status = EXIT_FAILURE << 8;	//what a stage that never started reports.
+		//if child is a background process:
+		if(background) {
+			if(stage->pid != -1) {
+				printf("background pid is %d\n",stage->pid);
+				fflush(stdout);
+			}
+			continue;
+		}
+		//else child is in foreground.
+		if(stage->pid != -1) {
+			status = waitJob(findJob(stage->pid));
+			if(WIFSTOPPED(status)) {
+				printf("pid %d stopped by signal %d\n",stage->pid,WSTOPSIG(status));
+				fflush(stdout);
+			}
+		}
+		if(stage->pipeNext == NULL) {
+			*exitStatus = status;
+		}
+	}
+	if(!background) {
+		if(WIFSIGNALED(*exitStatus)) {
+			printf("terminated by signal %d\n",WTERMSIG(*exitStatus));
+			fflush(stdout);
+		}
+	}
+}
+
+/* Input is read in chunks into inputBuffer and handed out a line at a time. Doing the reads here
+ * instead of through getline lets the prompt poll() the input and the child event fd together, so
+ * children are reaped while the shell sits at the prompt. Input comes from stdin, a script file,
+ * or for -c just the buffer, and only gets a prompt when it's a terminal. Anything else is read
+ * in big chunks with no prompt, since nobody is there to see it.
+ */
+#define INTERACTIVE_CHUNK 4096
+#define BATCH_CHUNK 65536
+int inputFd = STDIN_FILENO;	//-1 when all of the input is already in the buffer.
+bool interactive = true;
+char* inputBuffer = NULL;
+size_t inputSize = 0;
+size_t inputStart = 0;		//first byte not yet handed out.
+size_t inputEnd = 0;		//end of the bytes read so far.
+
+//Where the shell reads commands from: a script file, the -c string, or else stdin.
+void inputSet(char* script, char* commandString) {
+	if(commandString != NULL) {
+		inputFd = -1;
+		inputSize = strlen(commandString) + 2;
+		inputBuffer = xmalloc(inputSize);
+		inputEnd = sprintf(inputBuffer,"%s\n",commandString);
+	}
+	else if(script != NULL) {
+		inputFd = open(script,O_RDONLY|O_CLOEXEC);
+		if(inputFd == -1) {
+			fprintf(stderr,"smallsh: cannot open %s: %s.\n",script,strerror(errno));
+			fflush(stderr);
+			exit(127);
+		}
+	}
+	interactive = inputFd == STDIN_FILENO && isatty(STDIN_FILENO);
+}
+
+//Returns the next line of input without its newline, or NULL at end of input.
+char* readLine() {
+	while(1) {
+		char* newline = memchr(inputBuffer + inputStart,'\n',inputEnd - inputStart);
+		if(newline != NULL) {
+			char* line = inputBuffer + inputStart;
+			*newline = '\0';
+			inputStart = newline - inputBuffer + 1;
+			return line;
+		}
+		//slide the partial line to the front, and grow if it fills the buffer.
+		memmove(inputBuffer,inputBuffer + inputStart,inputEnd - inputStart);
+		inputEnd -= inputStart;
+		inputStart = 0;
+		if(inputFd == -1) {
+			return NULL;
+		}
+		if(inputEnd + 1 >= inputSize) {
+			size_t grownSize = inputSize ? inputSize * 2 : interactive ? INTERACTIVE_CHUNK : BATCH_CHUNK;
+			char* grown = xmalloc(grownSize);
+			memcpy(grown,inputBuffer,inputEnd);
+			free(inputBuffer);
+			inputBuffer = grown;
+			inputSize = grownSize;
+		}
+
+		//SIGTSTP stays blocked from the check until ppoll is waiting, so a ^Z can't slip in between.
+		struct pollfd events[2] = { { inputFd, POLLIN, 0 }, { childEventFd, POLLIN, 0 } };
+		sigset_t tstp, waitMask;
+		sigemptyset(&tstp);
+		sigaddset(&tstp,SIGTSTP);
+		sigprocmask(SIG_BLOCK,&tstp,&waitMask);
+		if(sigtstpPending) {
+			modeMessage(interactive);
+		}
+		int ready = ppoll(events,2,NULL,&waitMask);
+		sigprocmask(SIG_SETMASK,&waitMask,NULL);
+		if(ready == -1) {
+			continue;
+		}
+		if(events[1].revents & POLLIN) {
+			reapChildren();
+		}
+		if(events[0].revents) {
+			ssize_t numChars = read(inputFd,inputBuffer + inputEnd,inputSize - inputEnd - 1);
+			if(numChars > 0) {
+				inputEnd += numChars;
+			}
+			//at the end of input, a last line without a newline still counts.
+			else if(numChars == 0 || errno != EINTR) {
+				if(inputEnd == 0) {
+					return NULL;
+				}
+				inputBuffer[inputEnd] = '\0';
+				inputStart = inputEnd = 0;
+				return inputBuffer;
+			}
+		}
+	}
+}
+
+/* Command history. An interactive shell keeps its last HISTORY_SIZE lines in a ring and appends them
+ * to $MSHELL_HISTFILE, or ~/.mshell_history, HISTORY_BATCH lines to a write and the rest at exit.
+ * Earlier sessions' history is only mapped when the file is first needed: nothing reads it until the
+ * history builtin asks, and then only the tail that fits in the ring, so a long file doesn't slow startup.
+ */
+#define HISTORY_SIZE 1000
+#define HISTORY_BATCH 16
+char* history[HISTORY_SIZE];
+int historyEnd = 0;				//slot the next line goes in.
+int historyLength = 0;
+long historyNumber = 0;			//lines added so far, which numbers the newest one.
+int historyPending = 0;			//newest lines not written to the file yet.
+int historyFd = -1;
+char* historyMap = NULL;		//the file as it was before this session wrote to it, until it's been loaded.
+size_t historyMapSize = 0;
+bool historyWanted = false;		//interactive, so there's a file to keep. It's opened on first use.
+bool historyOpened = false;
+
+void historyOpen() {
+	char path[MAX_PATH];
+	char* file = getenv("MSHELL_HISTFILE");
+	if(file == NULL) {
+		if(getenv("HOME") == NULL) {
+			return;
+		}
+		snprintf(path,sizeof(path),"%s/.mshell_history",getenv("HOME"));
+		file = path;
+	}
+	historyFd = open(file,O_RDWR|O_APPEND|O_CREAT|O_CLOEXEC,0600);
+	struct stat st;
+	if(historyFd == -1 || fstat(historyFd,&st) == -1 || st.st_size == 0) {
+		return;
+	}
+	historyMap = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,historyFd,0);
+	if(historyMap == MAP_FAILED) {
+		historyMap = NULL;
+		return;
+	}
+	historyMapSize = st.st_size;
+}
+
+//Opens and maps the history file the first time it's needed, which is never for a quick session.
+void historyReady() {
+	if(historyWanted && !historyOpened) {
+		historyOpened = true;
+		historyOpen();
+	}
+}
+
+//The line n back from the newest, 0 being the newest.
+char** historyEntry(int n) {
+	return &history[(historyEnd - 1 - n + 2 * HISTORY_SIZE) % HISTORY_SIZE];
+}
+
+//Adds a heap copy of a line, dropping the oldest once the ring is full.
+void historyPush(char* line) {
+	free(history[historyEnd]);
+	history[historyEnd] = line;
+	historyEnd = (historyEnd + 1) % HISTORY_SIZE;
+	if(historyLength < HISTORY_SIZE) {
+		historyLength++;
+	}
+	historyNumber++;
+}
+
+//Writes out the pending lines with one writev.
+void historyFlush() {
+	struct iovec parts[2 * HISTORY_BATCH];
+	if(historyPending == 0) {
+		return;
+	}
+	historyReady();
+	if(historyFd == -1) {
+		historyPending = 0;
+		return;
+	}
+	for(int i=0; i<historyPending; i++) {
+		char* line = *historyEntry(historyPending - 1 - i);
+		parts[2 * i].iov_base = line;
+		parts[2 * i].iov_len = strlen(line);
+		parts[2 * i + 1].iov_base = "\n";
+		parts[2 * i + 1].iov_len = 1;
+	}
+	if(writev(historyFd,parts,2 * historyPending) == -1) {
+		perror("smallsh: history");
+		fflush(stderr);
+	}
+	historyPending = 0;
+}
+
+void historyAdd(const char* line) {
+	historyPush(xstrdup(line));
+	if(++historyPending == HISTORY_BATCH) {
+		historyFlush();
+	}
+}
+
+//Slots the tail of the mapped file in ahead of this session's lines, then lets the mapping go.
+void historyLoad() {
+	historyReady();
+	if(historyMap == NULL) {
+		return;
+	}
+	int session = historyLength;
+	int wanted = HISTORY_SIZE - session;
+	char** lines = xmalloc(session * sizeof(char*) + 1);
+	for(int i=0; i<session; i++) {
+		lines[i] = *historyEntry(session - 1 - i);
+		*historyEntry(session - 1 - i) = NULL;
+	}
+	//walk back from the end, past its newline, to where the last wanted lines start.
+	size_t end = historyMap[historyMapSize - 1] == '\n' ? historyMapSize - 1 : historyMapSize;
+	size_t start = end;
+	for(int found = 0; wanted > 0 && start > 0; start--) {
+		if(historyMap[start - 1] == '\n' && ++found == wanted) {
+			break;
+		}
+	}
+	long sessionNumber = historyNumber;
+	historyEnd = historyLength = 0;
+	historyNumber = 0;
+	for(size_t pos = start; pos < end;) {
+		char* newline = memchr(historyMap + pos,'\n',end - pos);
+		size_t length = (newline ? (size_t)(newline - historyMap) : end) - pos;
+		char* line = xmalloc(length + 1);
+		memcpy(line,historyMap + pos,length);
+		line[length] = '\0';
+		historyPush(line);
+		pos += length + 1;
+	}
+	for(int i=0; i<session; i++) {
+		historyPush(lines[i]);
+	}
+	historyNumber += sessionNumber - session;
+	free(lines);
+	munmap(historyMap,historyMapSize);
+	historyMap = NULL;
+}
+
+/* smallsh builtin: history
+ * usage: history [-c] [count]
+ * Lists the remembered command lines, numbered and oldest first, or just the last count of them.
+ * -c forgets them all, though anything already written to the history file stays there.
+ */
+void historyBuiltin(struct Command* cmnd, int* exitStatus) {
+	historyLoad();
+	if(cmnd->args[1] != NULL && strcmp(cmnd->args[1],"-c")==0) {
+		historyFlush();
+		for(int i=0; i<HISTORY_SIZE; i++) {
+			free(history[i]);
+			history[i] = NULL;
+		}
+		historyEnd = historyLength = 0;
+		return;
+	}
+	int count = cmnd->args[1] != NULL ? atoi(cmnd->args[1]) : historyLength;
+	if(count < 0 || count > historyLength) {
+		count = historyLength;
+	}
+	for(int i=count - 1; i>=0; i--) {
+		printf("%5ld  %s\n",historyNumber - i,*historyEntry(i));
+	}
+	fflush(stdout);
+}
+
+/* Adapted from Block 3.3: Advanced User Input example code. The line is copied into the arena.
+ * Returns false at the end of the input.
+ */
+bool getCommand(struct Command* cmnd) {
+	char* line;
+	//loops until user gives us a potentially viable command.
+	while(1) {
+		//what the last line did goes out before we wait on the next.
+		if(eventFd != -1) {
+			eventFlush();
+		}
+		//a ^Z during the last command gets its message before the next prompt.
+		if(sigtstpPending) {
+			modeMessage(false);
+		}
+		if(interactive) {
+			printf(": ");
+			fflush(stdout);
+		}
+		line = readLine();
+		if(line == NULL) {
+			if(interactive) {
+				printf("\n");
+				fflush(stdout);
+			}
+			return false;
+		}
+		//if the user entered nothing or if it's a comment line
+		if(line[0]=='\0' || line[0]==' ' || line[0]=='#') {
+			continue;
+		}
+		cmnd->rawCommand = arenaStrdup(line);
+		if(interactive) {
+			historyAdd(line);
+		}
+		return true;
+	}
+}
+
+/* Glob and brace expansion, run on the words the lexer marked as patterns. Quoted wildcards arrive
+ * backslash escaped, so every step here honours escapes, and whatever comes out the far end as a
+ * plain word has them taken back out.
+ */
+struct DirCache {
+	char* path;
+	int count;
+	char** names;
+	unsigned char* types;		//d_type of each name, DT_UNKNOWN when the filesystem won't say.
+	struct DirCache* next;
+};
+//Directories read for the command being parsed. Lives in the arena, so parseCommand starts it afresh.
+struct DirCache* dirCache = NULL;
+
+struct linuxDirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+//Every name in a directory but . and .., read once per command with getdents64.
+struct DirCache* readDirectory(const char* path) {
+	struct DirCache* dir;
+	char buf[16384];
+	long numBytes;
+	int size = 0;
+	for(dir = dirCache; dir != NULL; dir = dir->next) {
+		if(strcmp(dir->path,path)==0) {
+			return dir;
+		}
+	}
+	dir = arenaCalloc(sizeof(struct DirCache));
+	dir->path = arenaStrdup(path);
+	dir->next = dirCache;
+	dirCache = dir;
+	int fd = open(path[0] ? path : ".",O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if(fd == -1) {
+		return dir;
+	}
+	while((numBytes = syscall(SYS_getdents64,fd,buf,sizeof(buf))) > 0) {
+		for(long pos = 0; pos < numBytes;) {
+			struct linuxDirent64* entry = (struct linuxDirent64*)(buf + pos);
+			pos += entry->d_reclen;
+			if(strcmp(entry->d_name,".")==0 || strcmp(entry->d_name,"..")==0) {
+				continue;
+			}
+			if(dir->count == size) {
+				size = size ? size * 2 : 64;
+				char** names = arenaAlloc(size * sizeof(char*));
+				unsigned char* types = arenaAlloc(size);
+				if(dir->count > 0) {
+					memcpy(names,dir->names,dir->count * sizeof(char*));
+					memcpy(types,dir->types,dir->count);
+				}
+				dir->names = names;
+				dir->types = types;
+			}
+			dir->names[dir->count] = arenaStrdup(entry->d_name);
+			dir->types[dir->count++] = entry->d_type;
+		}
+	}
+	close(fd);
+	return dir;
+}
+
+//Takes the lexer's escaping backslashes back out of a word, in place.
+void unescapeWord(char* word) {
+	char* out = word;
+	for(; *word; word++) {
+		if(*word == '\\' && word[1] != '\0') {
+			word++;
+		}
+		*out++ = *word;
+	}
+	*out = '\0';
+}
+
+//Whether a piece of a pattern has an unescaped *, ? or [ in it.
+bool hasWildcard(const char* str, size_t length) {
+	for(size_t i=0; i<length; i++) {
+		if(str[i] == '\\') {
+			i++;
+		}
+		else if(str[i] == '*' || str[i] == '?' || str[i] == '[') {
+			return true;
+		}
+	}
+	return false;
+}
+
+char* joinPath(const char* path, const char* name, size_t nameLength, bool slash) {
+	size_t pathLength = strlen(path);
+	char* joined = arenaAlloc(pathLength + nameLength + 2);
+	memcpy(joined,path,pathLength);
+	memcpy(joined + pathLength,name,nameLength);
+	joined[pathLength + nameLength] = '/';
+	joined[pathLength + nameLength + slash] = '\0';
+	return joined;
+}
+
+/* Matches rest, the part of a pattern not used up yet, under path, and adds each file it names to
+ * stage. Components without wildcards are taken as they are; the rest are matched against the
+ * directory's names, with a leading dot only matched by a dot in the pattern.
+ */
+void globPath(struct Command* stage, char* path, char* rest) {
+	struct stat st;
+	char* slash = strchr(rest,'/');
+	size_t length = slash ? (size_t)(slash - rest) : strlen(rest);
+	if(!hasWildcard(rest,length)) {
+		//the path built up is plain text, so each literal component loses its escapes as it's joined.
+		char* joined = joinPath(path,rest,length,slash != NULL);
+		unescapeWord(joined + strlen(path));
+		if(slash != NULL) {
+			globPath(stage,joined,slash + 1);
+			return;
+		}
+		if(lstat(joined,&st) == 0) {
+			addArg(stage,joined);
+		}
+		return;
+	}
+	char* component = arenaAlloc(length + 1);
+	memcpy(component,rest,length);
+	component[length] = '\0';
+	struct DirCache* dir = readDirectory(path);
+	for(int i=0; i<dir->count; i++) {
+		if(fnmatch(component,dir->names[i],FNM_PERIOD) != 0) {
+			continue;
+		}
+		char* joined = joinPath(path,dir->names[i],strlen(dir->names[i]),slash != NULL);
+		if(slash == NULL) {
+			addArg(stage,joined);
+		}
+		//only directories can have the rest of the pattern inside them.
+		else if(dir->types[i] == DT_DIR || ((dir->types[i] == DT_LNK || dir->types[i] == DT_UNKNOWN) &&
+				stat(joined,&st) == 0 && S_ISDIR(st.st_mode))) {
+			globPath(stage,joined,slash + 1);
+		}
+	}
+}
+
+int compareArgs(const void* a, const void* b) {
+	return strcmp(*(char* const*)a,*(char* const*)b);
+}
+
+//Globs one word into sorted arguments. A pattern that matches nothing is passed on as it is, like sh.
+void globWord(struct Command* stage, char* word) {
+	int first = stage->numArgs;
+	if(hasWildcard(word,strlen(word))) {
+		globPath(stage,"",word);
+	}
+	if(stage->numArgs == first) {
+		unescapeWord(word);
+		addArg(stage,word);
+	}
+	qsort(stage->args + first,stage->numArgs - first,sizeof(char*),compareArgs);
+}
+
+//Glues a brace's prefix, one alternative and its suffix into a new word.
+char* braceWord(const char* prefix, size_t prefixLength, const char* middle, size_t middleLength, const char* suffix) {
+	size_t suffixLength = strlen(suffix);
+	char* word = arenaAlloc(prefixLength + middleLength + suffixLength + 1);
+	memcpy(word,prefix,prefixLength);
+	memcpy(word + prefixLength,middle,middleLength);
+	memcpy(word + prefixLength + middleLength,suffix,suffixLength + 1);
+	return word;
+}
+
+void expandWord(struct Command* stage, char* word);
+
+/* The {a..e} and {1..10} forms, counting down as well as up. Returns false if the braces hold
+ * anything else.
+ */
+bool braceSequence(struct Command* stage, char* word, size_t open, size_t close) {
+	char* body = word + open + 1;
+	char* dots = strstr(body,"..");
+	if(dots == NULL || dots >= word + close) {
+		return false;
+	}
+	char* end;
+	char number[32];
+	long first, last;
+	bool letters = dots == body + 1 && word + close == dots + 3 && isalpha((unsigned char)body[0]) &&
+			isalpha((unsigned char)dots[2]);
+	if(letters) {
+		first = body[0];
+		last = dots[2];
+	}
+	else {
+		first = strtol(body,&end,10);
+		if(end != dots || end == body) {
+			return false;
+		}
+		last = strtol(dots + 2,&end,10);
+		if(end != word + close || end == dots + 2) {
+			return false;
+		}
+	}
+	for(long i = first; ; i += first <= last ? 1 : -1) {
+		size_t length = letters ? 1 : (size_t)snprintf(number,sizeof(number),"%ld",i);
+		if(letters) {
+			number[0] = (char)i;
+		}
+		expandWord(stage,braceWord(word,open,number,length,word + close + 1));
+		if(i == last) {
+			break;
+		}
+	}
+	return true;
+}
+
+/* Brace expansion, then globbing. The first brace pair with a comma or a sequence in it is expanded,
+ * and each word that makes is expanded again, which takes care of nesting and of later braces.
+ * Braces with neither, like find's {}, are left alone.
+ */
+void expandWord(struct Command* stage, char* word) {
+	for(size_t open = 0; word[open]; open++) {
+		if(word[open] == '\\') {
+			if(word[open + 1]) open++;
+			continue;
+		}
+		if(word[open] != '{') {
+			continue;
+		}
+		//find the matching close, and the commas at this level.
+		int depth = 0;
+		size_t close, commas = 0;
+		for(close = open + 1; word[close]; close++) {
+			if(word[close] == '\\' && word[close + 1]) {
+				close++;
+			}
+			else if(word[close] == '{') {
+				depth++;
+			}
+			else if(word[close] == '}' && depth-- == 0) {
+				break;
+			}
+			else if(word[close] == ',' && depth == 0) {
+				commas++;
+			}
+		}
+		if(word[close] != '}') {
+			break;
+		}
+		if(commas == 0) {
+			if(braceSequence(stage,word,open,close)) {
+				return;
+			}
+			continue;
+		}
+		size_t start = open + 1;
+		depth = 0;
+		for(size_t i = start; i <= close; i++) {
+			if(word[i] == '\\' && i + 1 < close) {
+				i++;
+			}
+			else if(word[i] == '{') {
+				depth++;
+			}
+			else if(word[i] == '}' && depth > 0) {
+				depth--;
+			}
+			else if((word[i] == ',' && depth == 0) || i == close) {
+				expandWord(stage,braceWord(word,open,word + start,i - start,word + close + 1));
+				start = i + 1;
+			}
+		}
+		return;
+	}
+	globWord(stage,word);
+}
+
+/* Single pass lexer. Walks the raw line once, expanding variables and stripping quotes and backslashes
+ * as it goes, and writes each word into one output buffer with a null terminator after it. Tokens
+ * are handed out as (offset, length) views into that buffer, so args can point straight into it.
+ * Words with unquoted wildcards or braces are marked for expandWord. Unquoted '<', '>', '&' and
+ * '|' are operators even when they touch a word, along with ';' and the longer '<<<', '>>', '>|',
+ * '&>', '&>>', '&&' and '||'; '2>', '2>>' and '2>&1' are operators at the start of a word. $(...)
+ * runs as soon as the lexer gets to it, and its output is expanded like a variable's.
+ */
+enum TokenType { TOKEN_WORD, TOKEN_INPUT, TOKEN_HERE_STRING, TOKEN_OUTPUT, TOKEN_APPEND, TOKEN_ERROR,
+		TOKEN_ERROR_APPEND, TOKEN_ERROR_TO_OUTPUT, TOKEN_OUTPUT_ALL, TOKEN_APPEND_ALL, TOKEN_BACKGROUND, TOKEN_PIPE,
+		TOKEN_SEQUENCE, TOKEN_AND, TOKEN_OR, TOKEN_TEE };
+struct Token
+{
+	enum TokenType type;
+	size_t offset;		//start of a word in the lexer output, unused for operators.
+	size_t length;
+	bool pattern;		//has unquoted wildcards or braces, with quoted ones backslash escaped.
+};
+struct Lexer
+{
+	const char* input;
+	size_t pos;
+	char* output;
+	size_t outPos;
+	size_t size;		//room in output.
+	char* error;		//set if the line can't be tokenized.
+	bool dynamic;		//expanded a variable, $? or $(...), so the same line can lex differently later.
+};
+//Set while runList parses a command it's going to skip, so its $(...) don't run.
+bool parseSkipping = false;
+
+//The shell's pid as text, worked out once at startup for $$ expansion.
+char pidString[16];
+size_t pidLength = 0;
+void cachePid() {
+	pidLength = snprintf(pidString,sizeof(pidString),"%d",getpid());
+}
+char statusString[16];
+
+/* Looks for a variable reference just after a '$': $$, $?, $NAME or ${NAME}. Returns how many
+ * characters it takes up, or 0 if there isn't one, and points value at what it expands to. An
+ * unset variable expands to nothing.
+ */
+size_t variableReference(const char* in, const char** value, size_t* valueLength) {
+	size_t start = 0, length = 0;
+	*value = NULL;
+	*valueLength = 0;
+	if(in[0] == '$') {
+		*value = pidString;
+		*valueLength = pidLength;
+		return 1;
+	}
+	if(in[0] == '?') {
+		*valueLength = snprintf(statusString,sizeof(statusString),"%d",exitCode(shellStatus));
+		*value = statusString;
+		return 1;
+	}
+	if(in[0] == '{') {
+		start = 1;
+		while(in[start + length] != '}' && in[start + length] != '\0') {
+			length++;
+		}
+		if(in[start + length] != '}' || !validName(in + start,length)) {
+			return 0;
+		}
+	}
+	else {
+		while(isalnum((unsigned char)in[length]) || in[length] == '_') {
+			length++;
+		}
+		if(!validName(in,length)) {
+			return 0;
+		}
+	}
+	//an unset variable is an empty value, not a failed reference.
+	struct Variable* var = *findVariable(in + start,length);
+	*value = var != NULL ? var->entry + var->nameLength + 1 : "";
+	*valueLength = strlen(*value);
+	return start ? length + 2 : length;
+}
+
+/* Worst case size of the lexer output for a line: every character can gain an escaping backslash,
+ * every variable reference can grow into its value with a backslash on each character, plus a
+ * null per word. References inside single quotes get counted too, which only wastes a little.
+ */
+size_t lexerOutputSize(const char* input) {
+	size_t size = 2 * strlen(input) + 1;
+	for(const char* dollar = strchr(input,'$'); dollar != NULL; dollar = strchr(dollar + 1,'$')) {
+		const char* value;
+		size_t valueLength;
+		if(dollar[1] == '$') {
+			size += pidLength;
+			dollar++;
+			continue;
+		}
+		dollar += variableReference(dollar + 1,&value,&valueLength);
+		size += 2 * valueLength;
+	}
+	return size;
+}
+
+//Characters the glob stage cares about: the ones that make a word a pattern, and the rest of its syntax.
+enum { GLOB_START = 1, GLOB_SYNTAX };
+const unsigned char globChars[256] = {
+	['*'] = GLOB_START, ['?'] = GLOB_START, ['['] = GLOB_START, ['{'] = GLOB_START,
+	[']'] = GLOB_SYNTAX, ['}'] = GLOB_SYNTAX, [','] = GLOB_SYNTAX, ['\\'] = GLOB_SYNTAX,
+};
+
+void runList(struct Command* cmnd, int* exitStatus);
+
+/* Finds the ')' closing a $( that starts just before in, skipping over quotes and nested
+ * parentheses. Returns its offset from in, or -1 if the line ends first.
+ */
+long substitutionEnd(const char* in) {
+	int depth = 1;
+	char quote = 0;
+	for(long i=0; in[i] != '\0'; i++) {
+		if(quote == '\'') {
+			quote = in[i] == '\'' ? 0 : quote;
+		}
+		else if(in[i] == '\\' && in[i + 1] != '\0') {
+			i++;
+		}
+		else if(in[i] == '"' || (in[i] == '\'' && !quote)) {
+			quote = quote ? 0 : in[i];
+		}
+		else if(!quote && in[i] == '(') {
+			depth++;
+		}
+		else if(!quote && in[i] == ')' && --depth == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Runs the text of a $(...) in a forked copy of the shell with stdout into a pipe, and returns
+ * what it wrote, read in big chunks straight into the arena with the trailing newlines trimmed.
+ * The length goes in length. The copy runs the text like any line, lists and all. It starts with
+ * no jobs, history or cgroup of its own, and without the shell's own fds, so nothing it runs, exit
+ * and wait included, can reach the shell's helpers, background jobs, history file or cgroups.
+ */
+bool substituting = false;		//in the forked copy, where exit just ends the copy.
+
+char* substitute(const char* text, size_t textLength, size_t* length) {
+	int fds[2];
+	*length = 0;
+	char* line = arenaAlloc(textLength + 1);
+	memcpy(line,text,textLength);
+	line[textLength] = '\0';
+	fflush(stdout);
+	if(pipe2(fds,O_CLOEXEC) == -1) {
+		perror("smallsh: pipe");
+		fflush(stderr);
+		return "";
+	}
+	pid_t pid = fork();
+	if(pid == -1) {
+		perror("smallsh: fork");
+		fflush(stderr);
+		close(fds[0]);
+		close(fds[1]);
+		return "";
+	}
+	if(pid == 0) {
+		int status = 0;
+		dup2(fds[1],STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		forkedCopyClose();
+		//the events already logged are the parent's to send.
+		eventTail = eventHead;
+		jobs = NULL;
+		jobsSize = numJobs = numDoneJobs = 0;
+		historyWanted = false;
+		historyPending = 0;
+		cgroupSlice = NULL;
+		cgroupTried = true;
+		substituting = true;
+		if(launcher == LAUNCH_ZYGOTE) {
+			launcher = LAUNCH_SPAWN;
+		}
+		struct Command* cmnd = newCommand();
+		cmnd->rawCommand = line;
+		runList(cmnd,&status);
+		fflush(stdout);
+		if(eventFd != -1) {
+			eventFlush();
+		}
+		_exit(exitCode(status));
+	}
+	close(fds[1]);
+	struct Job* job = addJob(pid,0,false,line);
+	size_t size = BATCH_CHUNK;
+	char* output = arenaAlloc(size);
+	ssize_t numChars;
+	while((numChars = read(fds[0],output + *length,size - *length)) != 0) {
+		if(numChars == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		*length += numChars;
+		if(*length == size) {
+			char* grown = arenaAlloc(size * 2);
+			memcpy(grown,output,size);
+			output = grown;
+			size *= 2;
+		}
+	}
+	close(fds[0]);
+	waitJob(job);
+	while(*length > 0 && output[*length - 1] == '\n') {
+		(*length)--;
+	}
+	return output;
+}
+
+//Fills in the next token. Returns false at the end of the line, or on an error.
+bool nextToken(struct Lexer* lex, struct Token* token) {
+	const char* in = lex->input;
+	char* out = lex->output;
+	char quote = 0;
+	char c;
+	while(in[lex->pos]==' ' || in[lex->pos]=='\t') {
+		lex->pos++;
+	}
+	switch(in[lex->pos]) {
+		case '\0': return false;
+		case '<':
+			if(in[lex->pos+1] == '<' && in[lex->pos+2] == '<') {
+				token->type = TOKEN_HERE_STRING;
+				lex->pos += 3;
+				return true;
+			}
+			token->type = TOKEN_INPUT;
+			lex->pos++;
+			return true;
+		case '>':
+			token->type = in[lex->pos+1] == '>' ? TOKEN_APPEND : in[lex->pos+1] == '|' ? TOKEN_TEE : TOKEN_OUTPUT;
+			lex->pos += token->type == TOKEN_OUTPUT ? 1 : 2;
+			return true;
+		case '&':
+			if(in[lex->pos+1] == '>') {
+				token->type = in[lex->pos+2] == '>' ? TOKEN_APPEND_ALL : TOKEN_OUTPUT_ALL;
+				lex->pos += token->type == TOKEN_APPEND_ALL ? 3 : 2;
+				return true;
+			}
+			token->type = in[lex->pos+1] == '&' ? TOKEN_AND : TOKEN_BACKGROUND;
+			lex->pos += token->type == TOKEN_AND ? 2 : 1;
+			return true;
+		case '|':
+			token->type = in[lex->pos+1] == '|' ? TOKEN_OR : TOKEN_PIPE;
+			lex->pos += token->type == TOKEN_OR ? 2 : 1;
+			return true;
+		case ';': token->type = TOKEN_SEQUENCE; lex->pos++; return true;
+		//2> and the rest only count at the start of a word, so a2>f is still a2 into f.
+		case '2':
+			if(in[lex->pos+1] != '>') {
+				break;
+			}
+			if(in[lex->pos+2] == '&' && in[lex->pos+3] == '1') {
+				token->type = TOKEN_ERROR_TO_OUTPUT;
+				lex->pos += 4;
+			}
+			else {
+				token->type = in[lex->pos+2] == '>' ? TOKEN_ERROR_APPEND : TOKEN_ERROR;
+				lex->pos += token->type == TOKEN_ERROR_APPEND ? 3 : 2;
+			}
+			return true;
+	}
+	token->type = TOKEN_WORD;
+	//the word loop works on locals; stores through out could alias lex and force reloads every character.
+	size_t pos = lex->pos, outPos = lex->outPos;
+	bool pattern = false, escaped = false, quoted = false;
+	token->offset = outPos;
+	while((c = in[pos]) != '\0') {
+		bool literal = quote != 0;
+		//everything inside single quotes is literal.
+		if(quote == '\'') {
+			if(c == '\'') {
+				quote = 0;
+				pos++;
+				continue;
+			}
+		}
+		else {
+			if(!quote && (c==' ' || c=='\t' || c=='<' || c=='>' || c=='&' || c=='|' || c==';')) {
+				break;
+			}
+			//sweet $$ expansion. I like this one.
+			if(c == '$' && in[pos+1] == '$') {
+				memcpy(out + outPos,pidString,pidLength);
+				outPos += pidLength;
+				pos += 2;
+				continue;
+			}
+			//the rest of the variables, and $(...). Values come out literal, without splitting.
+			const char* value = NULL;
+			size_t valueLength, used;
+			if(c == '$' && in[pos+1] == '(') {
+				long end = substitutionEnd(in + pos + 2);
+				if(end == -1) {
+					lex->error = "unterminated $(";
+					return false;
+				}
+				valueLength = 0;
+				value = parseSkipping ? "" : substitute(in + pos + 2,end,&valueLength);
+				pos += end + 3;
+				//output can be any size, so the word so far moves to a bigger buffer if it won't fit.
+				if(outPos + 2 * valueLength + lexerOutputSize(in + pos) > lex->size) {
+					size_t word = outPos - token->offset;
+					lex->size = word + 2 * valueLength + lexerOutputSize(in + pos);
+					out = lex->output = memcpy(arenaAlloc(lex->size),out + token->offset,word);
+					token->offset = 0;
+					outPos = word;
+				}
+			}
+			else if(c == '$' && (used = variableReference(in + pos + 1,&value,&valueLength)) != 0) {
+				pos += used + 1;
+			}
+			if(value != NULL) {
+				lex->dynamic = true;
+				for(size_t i=0; i<valueLength; i++) {
+					if(globChars[(unsigned char)value[i]]) {
+						out[outPos++] = '\\';
+						escaped = true;
+					}
+					out[outPos++] = value[i];
+				}
+				continue;
+			}
+			if(c == '"' || (c == '\'' && !quote)) {
+				quote = quote ? 0 : c;
+				quoted = true;
+				pos++;
+				continue;
+			}
+			//backslash escapes anything outside quotes, and just $, " and \ inside double quotes.
+			if(c == '\\' && in[pos+1] != '\0' && (!quote || strchr("$\"\\",in[pos+1]))) {
+				c = in[++pos];
+				literal = true;
+			}
+		}
+		//wildcards and braces are for the glob stage, so quoted ones get a backslash to keep them literal.
+		if(globChars[(unsigned char)c]) {
+			if(literal || c == '\\') {
+				out[outPos++] = '\\';
+				escaped = true;
+			}
+			else if(globChars[(unsigned char)c] == GLOB_START) {
+				pattern = true;
+			}
+		}
+		out[outPos++] = c;
+		pos++;
+	}
+	//a word that was nothing but unset variables isn't a word at all, where "" still is.
+	if(outPos == token->offset && !quoted) {
+		lex->pos = pos;
+		return nextToken(lex,token);
+	}
+	token->pattern = pattern;
+	token->length = outPos - token->offset;
+	out[outPos++] = '\0';
+	lex->pos = pos;
+	lex->outPos = outPos;
+	//the backslashes only matter to a pattern.
+	if(escaped && !pattern) {
+		unescapeWord(out + token->offset);
+		token->length = strlen(out + token->offset);
+	}
+	if(quote) {
+		lex->error = "unterminated quote";
+		return false;
+	}
+	return true;
+}
+
+/* Records a redirect on a stage. A later redirect of the same stream replaces an earlier one. 2>&1
+ * copies stdout's target as it stands at that point, so a '>' after it moves stdout alone: stderr
+ * either keeps the earlier file, opened for it separately, or the pipe or terminal stdout had.
+ */
+void setRedirect(struct Command* stage, enum TokenType type, char* file) {
+	switch(type) {
+		case TOKEN_INPUT:
+		case TOKEN_HERE_STRING:
+			stage->inputRedirect = true;
+			stage->inputFile = type == TOKEN_INPUT ? file : NULL;
+			stage->hereString = type == TOKEN_HERE_STRING ? (file ? file : "") : NULL;
+			break;
+		case TOKEN_TEE:
+			stage->outputRedirect = false;
+			stage->teeFile = file ? file : "/dev/null";
+			break;
+		case TOKEN_OUTPUT:
+		case TOKEN_APPEND:
+		case TOKEN_OUTPUT_ALL:
+		case TOKEN_APPEND_ALL:
+			if(stage->errorToOutput && stage->outputRedirect) {
+				stage->errorRedirect = true;
+				stage->errorFile = stage->outputFile;
+				stage->errorAppend = stage->appendOutput;
+			}
+			stage->errorBeforeOutput = stage->errorToOutput && !stage->outputRedirect;
+			stage->errorToOutput = false;
+			stage->teeFile = NULL;
+			stage->outputRedirect = true;
+			stage->outputFile = file;
+			stage->appendOutput = type == TOKEN_APPEND || type == TOKEN_APPEND_ALL;
+			if(type == TOKEN_OUTPUT_ALL || type == TOKEN_APPEND_ALL) {
+				stage->errorRedirect = false;
+				stage->errorToOutput = true;
+				stage->errorBeforeOutput = false;
+			}
+			break;
+		case TOKEN_ERROR:
+		case TOKEN_ERROR_APPEND:
+			stage->errorRedirect = true;
+			stage->errorFile = file;
+			stage->errorAppend = type == TOKEN_ERROR_APPEND;
+			stage->errorToOutput = false;
+			stage->errorBeforeOutput = false;
+			break;
+		case TOKEN_ERROR_TO_OUTPUT:
+			stage->errorRedirect = false;
+			stage->errorToOutput = true;
+			stage->errorBeforeOutput = false;
+			break;
+		default:
+			break;
+	}
+}
+
+/* Parse cache, off unless MSHELL_PARSE_CACHE gives it a number of entries. Batch input that
+ * repeats the same lines gets their parsed pipelines back from an LRU table keyed on the raw text,
+ * skipping the lexer. Only lines that parse the same way every time are kept: nothing that expands
+ * a variable or $?, or globs. $$ can't change, so it's fine. Each entry is one heap block holding
+ * the stages, their args arrays and strings, with pointers into itself; a hit copies it into the
+ * arena and moves the pointers along, so commands can change their copy as they like.
+ */
+struct ParseEntry
+{
+	char* line;
+	unsigned int hash;
+	char* block;
+	size_t size;
+	long restOffset;			//where listRest was in line, or -1.
+	struct ParseEntry* chain;	//next entry in the same bucket.
+	struct ParseEntry* newer;
+	struct ParseEntry* older;
+};
+struct ParseEntry** parseBuckets = NULL;
+int parseCacheSize = 0, parseBucketCount = 0, parseEntries = 0;
+struct ParseEntry* parseNewest = NULL;
+struct ParseEntry* parseOldest = NULL;
+long parseHits = 0, parseMisses = 0, parseUncacheable = 0;
+
+//Sizes the cache; the buckets are allocated by the first store, so a short session never pays.
+void parseCacheInit(int size) {
+	parseCacheSize = size;
+	for(parseBucketCount = 16; parseBucketCount < size; parseBucketCount *= 2) {}
+}
+
+void parseUnlink(struct ParseEntry* entry) {
+	*(entry->newer ? &entry->newer->older : &parseNewest) = entry->older;
+	*(entry->older ? &entry->older->newer : &parseOldest) = entry->newer;
+}
+
+void parsePushNewest(struct ParseEntry* entry) {
+	entry->newer = NULL;
+	entry->older = parseNewest;
+	*(parseNewest ? &parseNewest->newer : &parseOldest) = entry;
+	parseNewest = entry;
+}
+
+void parseEvict(struct ParseEntry* entry) {
+	struct ParseEntry** link = &parseBuckets[entry->hash & (parseBucketCount - 1)];
+	while(*link != entry) {
+		link = &(*link)->chain;
+	}
+	*link = entry->chain;
+	parseUnlink(entry);
+	free(entry->line);
+	free(entry->block);
+	free(entry);
+	parseEntries--;
+}
+
+//Moves a pointer that points into one copy of a block to the same place in another.
+char* parseMove(const char* ptr, const char* from, char* to) {
+	return ptr ? to + (ptr - from) : NULL;
+}
+
+//Points every pointer of a block's pipeline, copied from one place to another, at the new copy.
+void parseRelocate(struct Command* cmnd, const char* from, char* to) {
+	for(struct Command* stage = cmnd; stage != NULL; stage = stage->pipeNext) {
+		stage->args = (char**)parseMove((char*)stage->args,from,to);
+		for(int i=0; i<stage->numArgs; i++) {
+			stage->args[i] = parseMove(stage->args[i],from,to);
+		}
+		stage->rawCommand = parseMove(stage->rawCommand,from,to);
+		stage->inputFile = parseMove(stage->inputFile,from,to);
+		stage->hereString = parseMove(stage->hereString,from,to);
+		stage->outputFile = parseMove(stage->outputFile,from,to);
+		stage->errorFile = parseMove(stage->errorFile,from,to);
+		stage->teeFile = parseMove(stage->teeFile,from,to);
+		stage->pipeNext = (struct Command*)parseMove((char*)stage->pipeNext,from,to);
+	}
+}
+
+//Copies a string into a block being built, if it's there at all.
+char* parseCopyString(char** end, const char* str) {
+	if(str == NULL) {
+		return NULL;
+	}
+	size_t length = strlen(str) + 1;
+	char* copy = memcpy(*end,str,length);
+	*end += length;
+	return copy;
+}
+
+//Remembers the pipeline line parsed to, throwing out the least recently used entry if it's full.
+void parseCacheStore(char* line, unsigned int hash, struct Command* cmnd) {
+	int numStages = 0;
+	size_t size = 0;
+	for(struct Command* stage = cmnd; stage != NULL; stage = stage->pipeNext) {
+		numStages++;
+		size += sizeof(struct Command) + (stage->numArgs + 1) * sizeof(char*);
+		char* strings[] = { stage->rawCommand, stage->inputFile, stage->hereString, stage->outputFile, stage->errorFile,
+				stage->teeFile };
+		for(int i=0; i<6; i++) {
+			size += strings[i] ? strlen(strings[i]) + 1 : 0;
+		}
+		for(int i=0; i<stage->numArgs; i++) {
+			size += strlen(stage->args[i]) + 1;
+		}
+	}
+	if(parseEntries == parseCacheSize) {
+		parseEvict(parseOldest);
+	}
+	struct ParseEntry* entry = xmalloc(sizeof(struct ParseEntry));
+	entry->line = xstrdup(line);
+	entry->hash = hash;
+	entry->size = size;
+	entry->block = xmalloc(size);
+	entry->restOffset = cmnd->listRest ? cmnd->listRest - line : -1;
+	struct Command* stages = (struct Command*)entry->block;
+	char* end = entry->block + numStages * sizeof(struct Command);
+	int i = 0;
+	for(struct Command* stage = cmnd; stage != NULL; stage = stage->pipeNext, i++) {
+		struct Command* copy = &stages[i];
+		*copy = *stage;
+		copy->args = (char**)end;
+		copy->argsSize = stage->numArgs + 1;
+		end += copy->argsSize * sizeof(char*);
+		copy->pipeNext = stage->pipeNext ? &stages[i + 1] : NULL;
+		copy->listRest = NULL;
+	}
+	i = 0;
+	for(struct Command* stage = cmnd; stage != NULL; stage = stage->pipeNext, i++) {
+		struct Command* copy = &stages[i];
+		for(int arg=0; arg<stage->numArgs; arg++) {
+			copy->args[arg] = parseCopyString(&end,stage->args[arg]);
+		}
+		copy->args[stage->numArgs] = NULL;
+		copy->rawCommand = parseCopyString(&end,stage->rawCommand);
+		copy->inputFile = parseCopyString(&end,stage->inputFile);
+		copy->hereString = parseCopyString(&end,stage->hereString);
+		copy->outputFile = parseCopyString(&end,stage->outputFile);
+		copy->errorFile = parseCopyString(&end,stage->errorFile);
+		copy->teeFile = parseCopyString(&end,stage->teeFile);
+	}
+	if(parseBuckets == NULL) {
+		parseBuckets = xmalloc(parseBucketCount * sizeof(struct ParseEntry*));
+		memset(parseBuckets,0,parseBucketCount * sizeof(struct ParseEntry*));
+	}
+	struct ParseEntry** bucket = &parseBuckets[hash & (parseBucketCount - 1)];
+	entry->chain = *bucket;
+	*bucket = entry;
+	parsePushNewest(entry);
+	parseEntries++;
+}
+
+//Fills in cmnd from the cache if line is in it, the most recently used entry from then on.
+bool parseCacheFind(struct Command* cmnd, char* line, unsigned int hash) {
+	if(parseBuckets == NULL) {
+		return false;
+	}
+	struct ParseEntry* entry = parseBuckets[hash & (parseBucketCount - 1)];
+	while(entry != NULL && (entry->hash != hash || strcmp(entry->line,line) != 0)) {
+		entry = entry->chain;
+	}
+	if(entry == NULL) {
+		return false;
+	}
+	parseUnlink(entry);
+	parsePushNewest(entry);
+	char* copy = memcpy(arenaAlloc(entry->size),entry->block,entry->size);
+	struct Command* stages = (struct Command*)copy;
+	parseRelocate(stages,entry->block,copy);
+	*cmnd = stages[0];
+	cmnd->listRest = entry->restOffset >= 0 ? line + entry->restOffset : NULL;
+	return true;
+}
+
+/* smallsh builtin: parsecache
+ * usage: parsecache [-c]
+ * Reports how the parse cache is doing: hits, misses, lines it wouldn't keep, and how full it is.
+ * -c empties it and zeroes the counts.
+ */
+void parseCacheBuiltin(struct Command* cmnd, int* exitStatus) {
+	if(cmnd->args[1] != NULL && strcmp(cmnd->args[1],"-c")==0) {
+		while(parseOldest != NULL) {
+			parseEvict(parseOldest);
+		}
+		parseHits = parseMisses = parseUncacheable = 0;
+		return;
+	}
+	if(parseCacheSize == 0) {
+		printf("parsecache: off, set MSHELL_PARSE_CACHE to a number of entries to use it\n");
+	}
+	else {
+		printf("hits\t%ld\nmisses\t%ld\nuncacheable\t%ld\nentries\t%d of %d\n",
+				parseHits,parseMisses,parseUncacheable,parseEntries,parseCacheSize);
+	}
+	fflush(stdout);
+}
+
+/* Finishes off a stage, NULL terminating its args. A '>|' on it becomes a tee stage after it, which
+ * is returned as the new last stage.
+ */
+struct Command* closeStage(struct Command* stage) {
+	stage->args[stage->numArgs] = NULL;
+	if(stage->teeFile == NULL || stage->numArgs == 0) {
+		return stage;
+	}
+	struct Command* tee = newCommand();
+	tee->teeFile = stage->teeFile;
+	stage->teeFile = NULL;
+	addArg(tee,">|");
+	addArg(tee,tee->teeFile);
+	tee->args[tee->numArgs] = NULL;
+	stage->pipeNext = tee;
+	return tee;
+}
+
+//True for the operators that end a pipeline and join it to the next one.
+bool isListToken(enum TokenType type) {
+	return type == TOKEN_SEQUENCE || type == TOKEN_AND || type == TOKEN_OR;
+}
+
+/* Turns the raw user command input into useful information in the Command struct, adding a stage
+ * to the pipeline behind it for every '|'. Parsing stops at a ';', '&&' or '||', leaving the rest
+ * of the line in listRest for runList. Returns false if there's nothing to run, after saying why
+ * if the line was bad.
+ */
+bool parseCommand(struct Command* cmnd) {
+	struct Command* stage = cmnd;
+	struct Lexer lex = {0};
+	struct Token token;
+	struct timespec parseStart;
+	char* line = cmnd->rawCommand;
+	unsigned int hash = 0;
+	if(traceFd != -1 || eventFd != -1) {
+		clock_gettime(CLOCK_MONOTONIC,&parseStart);
+	}
+	if(parseCacheSize > 0) {
+		hash = hashString(line);
+		if(parseCacheFind(cmnd,line,hash)) {
+			parseHits++;
+			if(traceFd != -1) {
+				dprintf(traceFd,"parse\t%ld\t%s\n",nanosSince(&parseStart),cmnd->rawCommand);
+			}
+			if(eventFd != -1) {
+				logEvent(EVENT_PARSE,0,1,nanosSince(&parseStart),0,0,cmnd->rawCommand);
+			}
+			return true;
+		}
+	}
+	dirCache = NULL;
+	lex.input = cmnd->rawCommand;
+	lex.size = lexerOutputSize(cmnd->rawCommand);
+	lex.output = arenaAlloc(lex.size);
+	bool more = nextToken(&lex,&token);
+	while(more) {
+		if(token.type == TOKEN_WORD) {
+			if(token.pattern) {
+				expandWord(stage,lex.output + token.offset);
+				lex.dynamic = true;
+			}
+			else {
+				addArg(stage,lex.output + token.offset);
+			}
+			more = nextToken(&lex,&token);
+		}
+		//'&' flags a background process at the end of a command, anywhere else it's an argument.
+		else if(token.type == TOKEN_BACKGROUND) {
+			more = nextToken(&lex,&token);
+			if(!more || isListToken(token.type)) {
+				cmnd->backgroundProcess = true;
+			}
+			else {
+				addArg(stage,"&");
+			}
+		}
+		//the rest of the line waits until this pipeline has run, so its $? and variables are current.
+		else if(isListToken(token.type)) {
+			cmnd->listOp = token.type == TOKEN_SEQUENCE ? LIST_SEQUENCE : token.type == TOKEN_AND ? LIST_AND : LIST_OR;
+			cmnd->listRest = cmnd->rawCommand + lex.pos;
+			//the element's own text is what jobs and the trace should show.
+			size_t length = lex.pos - (token.type == TOKEN_SEQUENCE ? 1 : 2);
+			char* text = arenaAlloc(length + 1);
+			memcpy(text,cmnd->rawCommand,length);
+			text[length] = '\0';
+			cmnd->rawCommand = text;
+			break;
+		}
+		//close off this stage and start the next one.
+		else if(token.type == TOKEN_PIPE) {
+			if(stage->numArgs == 0) {
+				break;
+			}
+			stage = closeStage(stage);
+			stage->pipeNext = newCommand();
+			stage = stage->pipeNext;
+			more = nextToken(&lex,&token);
+		}
+		//flag the redirect and store the file name. No file name means /dev/null.
+		else {
+			enum TokenType type = token.type;
+			char* file = NULL;
+			more = nextToken(&lex,&token);
+			if(type != TOKEN_ERROR_TO_OUTPUT && more && token.type == TOKEN_WORD) {
+				file = lex.output + token.offset;
+				//file names aren't globbed, a pattern is just its own name.
+				if(token.pattern) {
+					unescapeWord(file);
+				}
+				more = nextToken(&lex,&token);
+			}
+			setRedirect(stage,type,file);
+		}
+	}
+	//make sure the command array is NULL terminated.
+	stage = closeStage(stage);
+	//every stage of a pipeline needs a command, and so does either side of '&&' and '||'.
+	if(lex.error == NULL && stage->numArgs == 0 && (stage != cmnd || (more && cmnd->listOp == LIST_NONE))) {
+		lex.error = "syntax error near '|'";
+	}
+	else if(lex.error == NULL && cmnd->listOp != LIST_NONE && (cmnd->numArgs == 0 ||
+			(cmnd->listOp != LIST_SEQUENCE && cmnd->listRest[strspn(cmnd->listRest," \t")] == '\0'))) {
+		lex.error = cmnd->listOp == LIST_SEQUENCE ? "syntax error near ';'" :
+				cmnd->listOp == LIST_AND ? "syntax error near '&&'" : "syntax error near '||'";
+	}
+	if(traceFd != -1) {
+		dprintf(traceFd,"parse\t%ld\t%s\n",nanosSince(&parseStart),cmnd->rawCommand);
+	}
+	if(eventFd != -1) {
+		logEvent(EVENT_PARSE,0,0,nanosSince(&parseStart),0,0,cmnd->rawCommand);
+	}
+	if(lex.error != NULL) {
+		fprintf(stderr,"smallsh: %s.\n",lex.error);
+		fflush(stderr);
+		cmnd->listRest = NULL;
+		cmnd->syntaxError = true;
+		return false;
+	}
+	if(parseCacheSize > 0 && cmnd->numArgs > 0) {
+		if(lex.dynamic) {
+			parseUncacheable++;
+		}
+		else {
+			parseMisses++;
+			parseCacheStore(line,hash,cmnd);
+		}
+	}
+	return cmnd->numArgs > 0;
+}
+
+/* Reads all of the text parallel takes its commands from: the whole file if there is one, otherwise
+ * the shell's input up to its end. Returns a heap buffer and its length through length.
+ */
+char* parallelInput(char* file, size_t* length) {
+	size_t size = BATCH_CHUNK;
+	char* text = xmalloc(size);
+	ssize_t numChars;
+	*length = 0;
+	if(file == NULL) {
+		char* line;
+		while((line = readLine()) != NULL) {
+			size_t lineLength = strlen(line);
+			if(*length + lineLength + 1 >= size) {
+				while(*length + lineLength + 1 >= size) {
+					size *= 2;
+				}
+				char* grown = xmalloc(size);
+				memcpy(grown,text,*length);
+				free(text);
+				text = grown;
+			}
+			memcpy(text + *length,line,lineLength);
+			*length += lineLength;
+			text[(*length)++] = '\n';
+		}
+		return text;
+	}
+	int fd = open(file,O_RDONLY|O_CLOEXEC);
+	if(fd == -1) {
+		fprintf(stderr,"parallel: cannot open %s: %s.\n",file,strerror(errno));
+		fflush(stderr);
+		free(text);
+		return NULL;
+	}
+	while((numChars = read(fd,text + *length,size - *length)) > 0) {
+		*length += numChars;
+		if(*length == size) {
+			char* grown = xmalloc(size * 2);
+			memcpy(grown,text,*length);
+			free(text);
+			text = grown;
+			size *= 2;
+		}
+	}
+	close(fd);
+	return text;
+}
+
+//A command parallel has running: which input line it came from, and the pids of its stages.
+struct ParallelSlot
+{
+	int index;
+	int numPids;
+	pid_t* pids;			//-1 for a stage that didn't start.
+};
+
+/* Parses and starts one of parallel's commands in a free slot. Returns false if the line didn't
+ * parse. What the parser allocates is only needed until the stages are started, so it goes back
+ * to the arena straight after.
+ */
+bool parallelStart(char* line, struct ParallelSlot* slot) {
+	struct ArenaMark mark = arenaMark();
+	struct Command* cmnd = newCommand();
+	struct Command* stage;
+	cmnd->rawCommand = line;
+	bool parsed = parseCommand(cmnd);
+	//one line is one command here; a list would need its parts run in order.
+	if(parsed && cmnd->listRest != NULL) {
+		fprintf(stderr,"smallsh: parallel: ';', '&&' and '||' aren't supported.\n");
+		fflush(stderr);
+		parsed = false;
+	}
+	if(parsed) {
+		//the commands all run at once already, and stdin isn't theirs to read.
+		cmnd->backgroundProcess = false;
+		if(!cmnd->inputRedirect) {
+			cmnd->inputRedirect = true;
+		}
+		startPipeline(cmnd,false);
+		slot->numPids = 0;
+		for(stage = cmnd; stage != NULL; stage = stage->pipeNext) {
+			slot->numPids++;
+		}
+		slot->pids = xmalloc(slot->numPids * sizeof(pid_t));
+		slot->numPids = 0;
+		for(stage = cmnd; stage != NULL; stage = stage->pipeNext) {
+			slot->pids[slot->numPids++] = stage->pid;
+		}
+	}
+	arenaRelease(mark);
+	return parsed;
+}
+
+/* If every stage of the command in a slot is done, forget its jobs, store the status of its last
+ * stage, and return true.
+ */
+bool parallelFinished(struct ParallelSlot* slot, int* status) {
+	for(int i=0; i<slot->numPids; i++) {
+		if(slot->pids[i] != -1 && findJob(slot->pids[i])->state != JOB_DONE) {
+			return false;
+		}
+	}
+	*status = EXIT_FAILURE << 8;
+	for(int i=0; i<slot->numPids; i++) {
+		if(slot->pids[i] != -1) {
+			struct Job* job = findJob(slot->pids[i]);
+			*status = job->status;
+			removeJob(job);
+		}
+		else {
+			*status = EXIT_FAILURE << 8;
+		}
+	}
+	free(slot->pids);
+	return true;
+}
+
+/* smallsh builtin: parallel
+ * usage: parallel [-j N] [--cpus list] [--numa] [file]
+ * Runs every line of the file, or of the shell's input up to its end, as a command, with at most N
+ * of them running at once, the number of CPUs by default. Each time one finishes the next one is
+ * started, from the child event loop. Lines go through the same parser and launcher as the prompt,
+ * so $$, redirects and pipes work, but every line runs as a program and '&' is ignored. Commands
+ * read /dev/null unless they redirect stdin. Statuses are reported in input order, and the status
+ * of parallel itself is the number of commands that failed. --cpus and --numa place the commands
+ * the way they do for limit, so with --numa they take the nodes in turn.
+ */
+void parallel(char** args, int* exitStatus) {
+	long maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+	char* file = NULL;
+	//placement comes on top of whatever limit parallel is running under.
+	struct Limits* outerLimits = commandLimits;
+	struct Limits limits = {0};
+	if(outerLimits != NULL) {
+		limits = *outerLimits;
+	}
+	for(int i=1; args[i] != NULL; i++) {
+		int used = placementOption(args,i,&limits);
+		if(used == -1) {
+			*exitStatus = EXIT_FAILURE << 8;
+			return;
+		}
+		if(used > 0) {
+			i += used - 1;
+			continue;
+		}
+		if(strncmp(args[i],"-j",2)==0) {
+			char* count = args[i][2] ? args[i] + 2 : args[++i];
+			maxJobs = count ? atol(count) : 0;
+			if(maxJobs < 1) {
+				fprintf(stderr,"parallel: -j needs a job count of at least 1.\n");
+				fflush(stderr);
+				*exitStatus = EXIT_FAILURE << 8;
+				return;
+			}
+		}
+		else {
+			file = args[i];
+		}
+	}
+	size_t length;
+	char* text = parallelInput(file,&length);
+	if(text == NULL) {
+		*exitStatus = EXIT_FAILURE << 8;
+		return;
+	}
+
+	//split into lines, skipping the blank and comment lines the prompt would skip.
+	int numLines = 0;
+	for(size_t i=0; i<length; i++) {
+		numLines += text[i] == '\n';
+	}
+	char** lines = xmalloc((numLines + 1) * sizeof(char*));
+	int numCommands = 0;
+	for(char* line = text; line < text + length; ) {
+		char* end = memchr(line,'\n',text + length - line);
+		if(end == NULL) {
+			end = text + length;
+		}
+		*end = '\0';
+		if(line[0] != '\0' && line[0] != ' ' && line[0] != '#') {
+			lines[numCommands++] = line;
+		}
+		line = end + 1;
+	}
+
+	int* statuses = xmalloc((numCommands + 1) * sizeof(int));
+	bool* done = xmalloc((numCommands + 1) * sizeof(bool));
+	struct ParallelSlot* slots = xmalloc(maxJobs * sizeof(struct ParallelSlot));
+	int running = 0, next = 0, reported = 0, failed = 0;
+	commandLimits = &limits;
+	while(reported < numCommands) {
+		//fill the free slots.
+		while(running < maxJobs && next < numCommands) {
+			done[next] = false;
+			if(parallelStart(lines[next],&slots[running])) {
+				slots[running++].index = next;
+			}
+			else {
+				statuses[next] = EXIT_FAILURE << 8;
+				done[next] = true;
+			}
+			next++;
+		}
+		//report whatever has finished, in input order.
+		while(reported < numCommands && reported < next && done[reported]) {
+			printf("[%d] %s: ",reported + 1,lines[reported]);
+			reportStatus(statuses[reported]);
+			if(statuses[reported] != 0) {
+				failed++;
+			}
+			reported++;
+		}
+		if(running == 0) {
+			continue;
+		}
+		waitChildEvent();
+		for(int i=0; i<running; ) {
+			int status;
+			if(parallelFinished(&slots[i],&status)) {
+				statuses[slots[i].index] = status;
+				done[slots[i].index] = true;
+				slots[i] = slots[--running];
+			}
+			else {
+				i++;
+			}
+		}
+	}
+	*exitStatus = (failed > 255 ? 255 : failed) << 8;
+	commandLimits = outerLimits;
+	free(slots);
+	free(done);
+	free(statuses);
+	free(lines);
+	free(text);
+}
+
+void routeCommand(struct Command* cmnd, int* exitStatus);
+
+/* smallsh builtin: time
+ * usage: time command...
+ * Runs the rest of the line, builtin or pipeline, and then reports on stderr the real time it took,
+ * the user and sys time and largest max RSS of its processes, their context switches, and the user
+ * and sys time the shell itself spent meanwhile. Process numbers come from wait4().
+ */
+void timeCommand(struct Command* cmnd, int* exitStatus) {
+	struct timespec start;
+	struct rusage before, after;
+	memmove(cmnd->args,cmnd->args + 1,cmnd->numArgs * sizeof(char*));
+	cmnd->numArgs--;
+	memset(&foregroundUsage,0,sizeof(foregroundUsage));
+	getrusage(RUSAGE_SELF,&before);
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	if(cmnd->numArgs > 0) {
+		routeCommand(cmnd,exitStatus);
+	}
+	long real = nanosSince(&start);
+	getrusage(RUSAGE_SELF,&after);
+	timersub(&after.ru_utime,&before.ru_utime,&after.ru_utime);
+	timersub(&after.ru_stime,&before.ru_stime,&after.ru_stime);
+	fprintf(stderr,"real\t%ld.%06lds\n",real / 1000000000L,real % 1000000000L / 1000);
+	fprintf(stderr,"user\t%ld.%06lds\n",(long)foregroundUsage.ru_utime.tv_sec,(long)foregroundUsage.ru_utime.tv_usec);
+	fprintf(stderr,"sys\t%ld.%06lds\n",(long)foregroundUsage.ru_stime.tv_sec,(long)foregroundUsage.ru_stime.tv_usec);
+	fprintf(stderr,"maxrss\t%ld KB\n",foregroundUsage.ru_maxrss);
+	fprintf(stderr,"ctxsw\t%ld voluntary, %ld involuntary\n",foregroundUsage.ru_nvcsw,foregroundUsage.ru_nivcsw);
+	fprintf(stderr,"shell\t%ld.%06lds user, %ld.%06lds sys\n",(long)after.ru_utime.tv_sec,(long)after.ru_utime.tv_usec,
+			(long)after.ru_stime.tv_sec,(long)after.ru_stime.tv_usec);
+	fflush(stderr);
+}
+
+//Parses a limit's value: a count, or bytes with an optional K, M, G or T. 0 if it's no good.
+long long limitValue(const char* str, bool bytes) {
+	char* end;
+	errno = 0;
+	long long value = strtoll(str,&end,10);
+	if(bytes && *end != '\0' && end[1] == '\0') {
+		const char* units = strchr("KMGT",toupper((unsigned char)*end));
+		for(int i = units ? units - "KMGT" + 1 : 0; i > 0; i--) {
+			value *= 1024;
+		}
+		end += units != NULL;
+	}
+	return end == str || *end != '\0' || errno != 0 || value <= 0 ? 0 : value;
+}
+
+/* smallsh builtin: limit
+ * usage: limit [-c cpuweight] [-m memory] [-i ioweight] [--cpus list] [--numa] [-r] [command...]
+ * Runs the rest of the line with the processes it launches in a cgroup of their own that has the
+ * given cpu.weight, memory.max and io.weight, or with the per-process fallbacks where cgroups can't
+ * be used. Builtins that run inside the shell aren't limited. Weights go from 1 to 10000 around the
+ * default of 100; memory takes K, M, G and T. Without a command the limits become the default for
+ * background jobs, -r clears that default, and limit on its own shows it. --cpus pins the
+ * processes to a CPU list like 0-3,8, and --numa hands each job the next NUMA node in turn, pinned
+ * to its CPUs and preferring its memory.
+ */
+void limitCommand(struct Command* cmnd, int* exitStatus) {
+	struct Limits limits = {0};
+	bool reset = false;
+	int i;
+	for(i=1; i<cmnd->numArgs && cmnd->args[i][0] == '-'; i++) {
+		char* arg = cmnd->args[i];
+		char option = arg[1];
+		int used = placementOption(cmnd->args,i,&limits);
+		if(used != 0) {
+			if(used == -1) {
+				*exitStatus = EXIT_FAILURE << 8;
+				return;
+			}
+			i += used - 1;
+			continue;
+		}
+		if(option == 'r' && arg[2] == '\0') {
+			reset = true;
+			continue;
+		}
+		char* value = arg[2] ? arg + 2 : cmnd->args[++i];
+		long long number = value != NULL ? limitValue(value,option == 'm') : 0;
+		if(option == 'c' && number > 0 && number <= 10000) {
+			limits.cpuWeight = number;
+		}
+		else if(option == 'm' && number > 0) {
+			limits.memoryMax = number;
+		}
+		else if(option == 'i' && number > 0 && number <= 10000) {
+			limits.ioWeight = number;
+		}
+		else {
+			fprintf(stderr,"smallsh: limit: bad option %s%s%s.\n",arg,arg[2] ? "" : " ",arg[2] ? "" : value ? value : "");
+			fflush(stderr);
+			*exitStatus = EXIT_FAILURE << 8;
+			return;
+		}
+	}
+	*exitStatus = 0;
+	if(i >= cmnd->numArgs) {
+		if(reset || hasLimits(&limits) || hasPlacement(&limits)) {
+			backgroundLimits = limits;
+			return;
+		}
+		char cpus[256] = "any";
+		if(backgroundLimits.pinned) {
+			formatCpuList(&backgroundLimits.cpus,cpus,sizeof(cpus));
+		}
+		printf("background jobs: cpu.weight %ld, memory.max %lld, io.weight %ld, cpus %s%s\n",
+				backgroundLimits.cpuWeight,backgroundLimits.memoryMax,backgroundLimits.ioWeight,
+				cpus,backgroundLimits.numa ? ", numa" : "");
+		//before the first limited job nothing is made or moved, so only say what's on offer.
+		char own[MAX_PATH], base[2 * MAX_PATH], available[256];
+		bool found = !cgroupTried && cgroupFind(own,base,sizeof(base),available,sizeof(available));
+		if(found) {
+			printf("cgroup: not made yet, jobs would go under %s\n",base);
+		}
+		else {
+			printf("cgroup: %s\n",cgroupSlice ? cgroupSlice : "none, limits use nice, RLIMIT_AS and ioprio");
+		}
+		for(int control=0; (found || cgroupSlice) && control<NUM_CONTROLS; control++) {
+			bool usable = found ? hasControl(available,controlNames[control]) : cgroupControls[control];
+			printf("%s: %s\n",controlNames[control],usable ? "cgroup" : "fallback");
+		}
+		fflush(stdout);
+		return;
+	}
+	memmove(cmnd->args,cmnd->args + i,(cmnd->numArgs - i + 1) * sizeof(char*));
+	cmnd->numArgs -= i;
+	commandLimits = &limits;
+	routeCommand(cmnd,exitStatus);
+	commandLimits = NULL;
+}
+
+/* Points the shell's own stdin, stdout and stderr at a utility builtin's redirect targets: the
+ * parent side of inputoutputRedirect, undone by redirectRestore with the copies of the originals
+ * kept in saved. Returns false, with nothing changed, if a target couldn't be opened.
+ */
+bool redirectApply(struct Command* cmnd, int saved[3]) {
+	int fds[3];
+	if(!openRedirects(cmnd,false,fds)) {
+		return false;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	bool errorMoves = cmnd->errorToOutput || cmnd->errorBeforeOutput;
+	for(int fd=0; fd<3; fd++) {
+		saved[fd] = -1;
+		if(fds[fd] != -1 || (fd == STDERR_FILENO && errorMoves)) {
+			saved[fd] = fcntl(fd,F_DUPFD_CLOEXEC,10);
+		}
+	}
+	if(cmnd->errorBeforeOutput) {
+		dup2(STDOUT_FILENO,STDERR_FILENO);
+	}
+	for(int fd=0; fd<3; fd++) {
+		if(fds[fd] != -1) {
+			dup2(fds[fd],fd);
+		}
+	}
+	closeRedirects(fds);
+	if(cmnd->errorToOutput) {
+		dup2(STDOUT_FILENO,STDERR_FILENO);
+	}
+	return true;
+}
+
+void redirectRestore(int saved[3]) {
+	fflush(stdout);
+	fflush(stderr);
+	for(int fd=0; fd<3; fd++) {
+		if(saved[fd] != -1) {
+			dup2(saved[fd],fd);
+			close(saved[fd]);
+		}
+	}
+}
+
+/* Writes the character for a backslash escape, str pointing just past the backslash, and returns
+ * where the escape ends. \c sets stop. echo -e and printf's %b spell octal \0nnn, printf formats
+ * spell it \nnn.
+ */
+const char* writeEscape(const char* str, bool octalZero, bool* stop) {
+	const char* simple = "a\ab\be\033f\fn\nr\rt\tv\v\\\\";
+	int value = 0, digits = 0;
+	if(*str == '\0') {
+		putchar('\\');
+		return str;
+	}
+	for(const char* s = simple; *s; s += 2) {
+		if(*str == s[0]) {
+			putchar(s[1]);
+			return str + 1;
+		}
+	}
+	if(*str == 'c') {
+		*stop = true;
+		return str + 1;
+	}
+	if(*str == 'x' && isxdigit((unsigned char)str[1])) {
+		for(str++; digits < 2 && isxdigit((unsigned char)*str); str++, digits++) {
+			value = value * 16 + (isdigit((unsigned char)*str) ? *str - '0' : tolower((unsigned char)*str) - 'a' + 10);
+		}
+		putchar(value);
+		return str;
+	}
+	if(octalZero ? *str == '0' : (*str >= '0' && *str <= '7')) {
+		int maxDigits = 3;
+		if(octalZero) {
+			str++;
+		}
+		for(; digits < maxDigits && *str >= '0' && *str <= '7'; str++, digits++) {
+			value = value * 8 + *str - '0';
+		}
+		putchar(value);
+		return str;
+	}
+	putchar('\\');
+	putchar(*str);
+	return str + 1;
+}
+
+/* smallsh builtin: echo
+ * usage: echo [-neE] [string...]
+ * Prints its arguments separated by spaces. -n leaves off the newline, -e turns on backslash
+ * escapes and -E turns them back off.
+ */
+void echoBuiltin(struct Command* cmnd, int* exitStatus) {
+	bool newline = true, escapes = false, stop = false;
+	int i = 1;
+	//an argument is only options if every letter in it is one, same as coreutils.
+	for(; cmnd->args[i] != NULL && cmnd->args[i][0] == '-' && cmnd->args[i][1] != '\0'; i++) {
+		const char* opt = cmnd->args[i] + 1;
+		if(strspn(opt,"neE") != strlen(opt)) {
+			break;
+		}
+		for(; *opt; opt++) {
+			if(*opt == 'n') newline = false;
+			else escapes = *opt == 'e';
+		}
+	}
+	for(int first = i; cmnd->args[i] != NULL && !stop; i++) {
+		if(i != first) {
+			putchar(' ');
+		}
+		const char* str = cmnd->args[i];
+		while(*str && !stop) {
+			if(escapes && *str == '\\') {
+				str = writeEscape(str + 1,true,&stop);
+			}
+			else {
+				putchar(*str++);
+			}
+		}
+	}
+	if(newline && !stop) {
+		putchar('\n');
+	}
+	*exitStatus = 0;
+}
+
+//The next printf argument as a number, 0 when they've run out; 'c gives the character's value.
+long long numberArgument(char*** args, bool* failed) {
+	char* str = **args;
+	char* end;
+	long long value;
+	if(str == NULL) {
+		return 0;
+	}
+	(*args)++;
+	if(str[0] == '\'' || str[0] == '"') {
+		return (unsigned char)str[1];
+	}
+	errno = 0;
+	value = strtoll(str,&end,0);
+	if(end == str || *end != '\0' || errno != 0) {
+		fprintf(stderr,"printf: %s: invalid number\n",str);
+		*failed = true;
+	}
+	return value;
+}
+
+double floatArgument(char*** args, bool* failed) {
+	char* str = **args;
+	char* end;
+	double value;
+	if(str == NULL) {
+		return 0;
+	}
+	(*args)++;
+	value = strtod(str,&end);
+	if(end == str || *end != '\0') {
+		fprintf(stderr,"printf: %s: invalid number\n",str);
+		*failed = true;
+	}
+	return value;
+}
+
+/* smallsh builtin: printf
+ * usage: printf format [argument...]
+ * Prints its arguments under the control of format, the C printf conversions plus %b for a string
+ * with echo -e escapes. The format is used again for as long as arguments are left over, and
+ * missing arguments are empty strings or 0.
+ */
+void printfBuiltin(struct Command* cmnd, int* exitStatus) {
+	char** args = cmnd->args + 1;
+	bool stop = false, failed = false;
+	if(*args == NULL) {
+		fprintf(stderr,"printf: missing operand\n");
+		fflush(stderr);
+		*exitStatus = EXIT_FAILURE << 8;
+		return;
+	}
+	const char* format = *args++;
+	char** passStart;
+	do {
+		passStart = args;
+		const char* fmt = format;
+		while(*fmt && !stop) {
+			if(*fmt == '\\') {
+				fmt = writeEscape(fmt + 1,false,&stop);
+				continue;
+			}
+			if(*fmt != '%') {
+				putchar(*fmt++);
+				continue;
+			}
+			if(fmt[1] == '%') {
+				putchar('%');
+				fmt += 2;
+				continue;
+			}
+			//copy out the conversion spec, with any * widths filled in from the arguments.
+			char spec[64];
+			size_t len = 0;
+			spec[len++] = *fmt++;
+			while(*fmt && len < sizeof(spec) - 16 && strchr("-+ #0123456789.*",*fmt)) {
+				if(*fmt == '*') {
+					len += snprintf(spec + len,16,"%d",(int)numberArgument(&args,&failed));
+					fmt++;
+				}
+				else {
+					spec[len++] = *fmt++;
+				}
+			}
+			while(*fmt && strchr("hlLqjzt",*fmt)) {
+				fmt++;
+			}
+			char conversion = *fmt ? *fmt++ : '\0';
+			if(strchr("diouxX",conversion) != NULL && conversion != '\0') {
+				spec[len++] = 'l';
+				spec[len++] = 'l';
+				spec[len++] = conversion;
+				spec[len] = '\0';
+				printf(spec,numberArgument(&args,&failed));
+			}
+			else if(strchr("aAeEfFgG",conversion) != NULL && conversion != '\0') {
+				spec[len++] = conversion;
+				spec[len] = '\0';
+				printf(spec,floatArgument(&args,&failed));
+			}
+			else if(conversion == 's' || conversion == 'c') {
+				char* str = *args ? *args++ : "";
+				char character[2] = { str[0], '\0' };
+				spec[len++] = 's';
+				spec[len] = '\0';
+				printf(spec,conversion == 's' ? str : character);
+			}
+			else if(conversion == 'b') {
+				const char* str = *args ? *args++ : "";
+				while(*str && !stop) {
+					str = *str == '\\' ? writeEscape(str + 1,true,&stop) : (putchar(*str), str + 1);
+				}
+			}
+			else {
+				fprintf(stderr,"printf: %%%c: invalid conversion\n",conversion);
+				failed = stop = true;
+			}
+		}
+	} while(!stop && *args != NULL && args != passStart);
+	fflush(stderr);
+	*exitStatus = (failed ? EXIT_FAILURE : EXIT_SUCCESS) << 8;
+}
+
+/* smallsh builtin: pwd
+ * Takes no arguments. Prints the current directory.
+ */
+void pwdBuiltin(struct Command* cmnd, int* exitStatus) {
+	char dir[MAX_PATH];
+	if(getcwd(dir,sizeof(dir)) == NULL) {
+		perror("pwd");
+		fflush(stderr);
+		*exitStatus = EXIT_FAILURE << 8;
+		return;
+	}
+	printf("%s\n",dir);
+	*exitStatus = 0;
+}
+
+void trueBuiltin(struct Command* cmnd, int* exitStatus) {
+	*exitStatus = 0;
+}
+
+void falseBuiltin(struct Command* cmnd, int* exitStatus) {
+	*exitStatus = EXIT_FAILURE << 8;
+}
+
+//The arguments of a test expression still to be evaluated.
+struct Test {
+	char** args;
+	int pos;
+	int end;
+	bool error;
+};
+
+bool testExpression(struct Test* test);
+
+bool isTestUnary(const char* str) {
+	return str[0] == '-' && str[1] != '\0' && str[2] == '\0' && strchr("bcdefghkLnprsStuwxzOG",str[1]) != NULL;
+}
+
+bool isTestBinary(const char* str) {
+	const char* ops[] = { "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+	for(int i=0; ops[i] != NULL; i++) {
+		if(strcmp(str,ops[i])==0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool testUnary(const char* op, const char* arg) {
+	struct stat st;
+	switch(op[1]) {
+		case 'n': return arg[0] != '\0';
+		case 'z': return arg[0] == '\0';
+		case 't': return isatty(atoi(arg));
+		case 'r': return access(arg,R_OK) == 0;
+		case 'w': return access(arg,W_OK) == 0;
+		case 'x': return access(arg,X_OK) == 0;
+		case 'h':
+		case 'L': return lstat(arg,&st) == 0 && S_ISLNK(st.st_mode);
+	}
+	if(stat(arg,&st) != 0) {
+		return false;
+	}
+	switch(op[1]) {
+		case 'b': return S_ISBLK(st.st_mode);
+		case 'c': return S_ISCHR(st.st_mode);
+		case 'd': return S_ISDIR(st.st_mode);
+		case 'f': return S_ISREG(st.st_mode);
+		case 'p': return S_ISFIFO(st.st_mode);
+		case 'S': return S_ISSOCK(st.st_mode);
+		case 'g': return (st.st_mode & S_ISGID) != 0;
+		case 'u': return (st.st_mode & S_ISUID) != 0;
+		case 'k': return (st.st_mode & S_ISVTX) != 0;
+		case 's': return st.st_size > 0;
+		case 'O': return st.st_uid == geteuid();
+		case 'G': return st.st_gid == getegid();
+	}
+	return true;	//-e
+}
+
+//-eq and the other integer comparisons make the whole test an error for anything but an integer.
+long long testInteger(struct Test* test, const char* str) {
+	char* end;
+	errno = 0;
+	long long value = strtoll(str,&end,10);
+	while(isspace((unsigned char)*end)) {
+		end++;
+	}
+	if(end == str || *end != '\0' || errno != 0) {
+		fprintf(stderr,"test: %s: integer expression expected\n",str);
+		test->error = true;
+	}
+	return value;
+}
+
+bool testBinary(struct Test* test, const char* left, const char* op, const char* right) {
+	struct stat leftStat, rightStat;
+	if(op[0] != '-') {
+		return (strcmp(left,right)==0) == (op[0] != '!');
+	}
+	if(strcmp(op,"-nt")==0 || strcmp(op,"-ot")==0 || strcmp(op,"-ef")==0) {
+		bool haveLeft = stat(left,&leftStat) == 0, haveRight = stat(right,&rightStat) == 0;
+		if(op[1] == 'e') {
+			return haveLeft && haveRight && leftStat.st_dev == rightStat.st_dev && leftStat.st_ino == rightStat.st_ino;
+		}
+		//a file that exists is newer than one that doesn't.
+		if(!haveLeft || !haveRight) {
+			return op[1] == 'n' ? haveLeft : haveRight;
+		}
+		long long diff = leftStat.st_mtim.tv_sec != rightStat.st_mtim.tv_sec ?
+				(long long)leftStat.st_mtim.tv_sec - rightStat.st_mtim.tv_sec :
+				(long long)leftStat.st_mtim.tv_nsec - rightStat.st_mtim.tv_nsec;
+		return op[1] == 'n' ? diff > 0 : diff < 0;
+	}
+	long long a = testInteger(test,left), b = testInteger(test,right);
+	if(strcmp(op,"-eq")==0) return a == b;
+	if(strcmp(op,"-ne")==0) return a != b;
+	if(strcmp(op,"-lt")==0) return a < b;
+	if(strcmp(op,"-le")==0) return a <= b;
+	if(strcmp(op,"-gt")==0) return a > b;
+	return a >= b;
+}
+
+bool testPrimary(struct Test* test) {
+	if(test->pos >= test->end) {
+		fprintf(stderr,"test: argument expected\n");
+		test->error = true;
+		return false;
+	}
+	char* arg = test->args[test->pos];
+	//a binary operator after the first word wins, so test ! = x and test -n = -n compare strings.
+	if(test->pos + 2 < test->end && isTestBinary(test->args[test->pos + 1])) {
+		test->pos += 3;
+		return testBinary(test,arg,test->args[test->pos - 2],test->args[test->pos - 1]);
+	}
+	if(strcmp(arg,"!")==0) {
+		test->pos++;
+		return !testPrimary(test);
+	}
+	if(strcmp(arg,"(")==0) {
+		test->pos++;
+		bool value = testExpression(test);
+		if(test->pos >= test->end || strcmp(test->args[test->pos],")")!=0) {
+			fprintf(stderr,"test: missing ')'\n");
+			test->error = true;
+		}
+		test->pos++;
+		return value;
+	}
+	if(isTestUnary(arg) && test->pos + 1 < test->end) {
+		test->pos += 2;
+		return testUnary(arg,test->args[test->pos - 1]);
+	}
+	test->pos++;
+	return arg[0] != '\0';
+}
+
+bool testAnd(struct Test* test) {
+	bool value = testPrimary(test);
+	while(test->pos < test->end && strcmp(test->args[test->pos],"-a")==0) {
+		test->pos++;
+		value = testPrimary(test) && value;
+	}
+	return value;
+}
+
+bool testExpression(struct Test* test) {
+	bool value = testAnd(test);
+	while(test->pos < test->end && strcmp(test->args[test->pos],"-o")==0) {
+		test->pos++;
+		value = testAnd(test) || value;
+	}
+	return value;
+}
+
+/* smallsh builtin: test, [
+ * usage: test expression, or [ expression ]
+ * Evaluates the file, string and integer tests of POSIX test, joined with !, -a, -o and
+ * parentheses. Exits 0 when the expression is true, 1 when it's false, and 2 when it's an error.
+ */
+void testBuiltin(struct Command* cmnd, int* exitStatus) {
+	struct Test test = { cmnd->args + 1, 0, cmnd->numArgs - 1, false };
+	if(strcmp(cmnd->args[0],"[")==0) {
+		if(test.end == 0 || strcmp(test.args[test.end - 1],"]")!=0) {
+			fprintf(stderr,"[: missing ']'\n");
+			fflush(stderr);
+			*exitStatus = 2 << 8;
+			return;
+		}
+		test.end--;
+	}
+	bool value = test.end > 0 && testExpression(&test);
+	if(!test.error && test.pos < test.end) {
+		fprintf(stderr,"test: %s: unexpected argument\n",test.args[test.pos]);
+		test.error = true;
+	}
+	fflush(stderr);
+	*exitStatus = (test.error ? 2 : !value) << 8;
+}
+
+/* smallsh builtin: export
+ * usage: export [NAME[=value] ...]
+ * Marks variables for the environment of the commands the shell runs, setting them first when
+ * given a value. With no arguments, lists the exported variables.
+ */
+void exportBuiltin(struct Command* cmnd, int* exitStatus) {
+	if(cmnd->args[1] == NULL) {
+		if(!variablesLoaded) {
+			variablesInit();
+		}
+		char** entries = arenaAlloc((numExported + 1) * sizeof(char*));
+		int count = 0;
+		for(int i=0; i<VAR_BUCKETS; i++) {
+			for(struct Variable* var = variables[i]; var != NULL; var = var->next) {
+				if(var->exported) {
+					entries[count++] = var->entry;
+				}
+			}
+		}
+		qsort(entries,count,sizeof(char*),compareArgs);
+		for(int i=0; i<count; i++) {
+			printf("export %s\n",entries[i]);
+		}
+		fflush(stdout);
+		return;
+	}
+	*exitStatus = 0;
+	for(int i=1; cmnd->args[i] != NULL; i++) {
+		char* equals = strchr(cmnd->args[i],'=');
+		size_t nameLength = equals ? (size_t)(equals - cmnd->args[i]) : strlen(cmnd->args[i]);
+		struct Variable* var;
+		if(!validName(cmnd->args[i],nameLength)) {
+			fprintf(stderr,"smallsh: export: %s: not a valid identifier.\n",cmnd->args[i]);
+			fflush(stderr);
+			*exitStatus = EXIT_FAILURE << 8;
+		}
+		else if(equals != NULL) {
+			setVariable(cmnd->args[i],true);
+		}
+		//exporting a variable that isn't set yet exports it empty.
+		else if((var = *findVariable(cmnd->args[i],nameLength)) == NULL) {
+			char* empty = arenaAlloc(nameLength + 2);
+			sprintf(empty,"%s=",cmnd->args[i]);
+			setVariable(empty,true);
+		}
+		else if(!var->exported) {
+			var->exported = true;
+			numExported++;
+			environDirty = true;
+		}
+	}
+}
+
+/* smallsh builtin: unset
+ * usage: unset NAME ...
+ * Forgets variables, taking them out of the environment of later commands if they were exported.
+ */
+void unsetBuiltin(struct Command* cmnd, int* exitStatus) {
+	*exitStatus = 0;
+	for(int i=1; cmnd->args[i] != NULL; i++) {
+		if(!validName(cmnd->args[i],strlen(cmnd->args[i]))) {
+			fprintf(stderr,"smallsh: unset: %s: not a valid identifier.\n",cmnd->args[i]);
+			fflush(stderr);
+			*exitStatus = EXIT_FAILURE << 8;
+			continue;
+		}
+		unsetVariable(cmnd->args[i]);
+	}
+}
+
+/* NAME=value words on their own set shell variables, which stay out of the environment unless
+ * exported. Returns false if the command isn't all assignments, so it runs as a program.
+ */
+bool assignVariables(struct Command* cmnd) {
+	for(int i=0; i<cmnd->numArgs; i++) {
+		char* equals = strchr(cmnd->args[i],'=');
+		if(equals == NULL || !validName(cmnd->args[i],equals - cmnd->args[i])) {
+			return false;
+		}
+	}
+	for(int i=0; i<cmnd->numArgs; i++) {
+		setVariable(cmnd->args[i],false);
+	}
+	return true;
+}
+
+//Adapters giving every builtin the handler signature of the dispatch table.
+void cdBuiltin(struct Command* cmnd, int* exitStatus) {
+	//cd function will check for a valid directory and chdir to HOME if no argument.
+	cd(cmnd->args[1]);
+	//zygotes would still run commands from the old directory.
+	zygoteDrain();
+}
+
+void statusBuiltin(struct Command* cmnd, int* exitStatus) {
+	//print the most recent exit status.
+	reportStatus(*exitStatus);
+}
+
+void hashBuiltin(struct Command* cmnd, int* exitStatus) {
+	//list, fill, or reset the command path cache.
+	hash(cmnd->args);
+}
+
+void jobsBuiltin(struct Command* cmnd, int* exitStatus) {
+	listJobs();
+}
+
+void waitCommand(struct Command* cmnd, int* exitStatus) {
+	waitBuiltin(cmnd->args[1],exitStatus);
+}
+
+void fgCommand(struct Command* cmnd, int* exitStatus) {
+	fgBuiltin(cmnd->args[1],exitStatus);
+}
+
+void bgCommand(struct Command* cmnd, int* exitStatus) {
+	bgBuiltin(cmnd->args[1]);
+}
+
+void parallelBuiltin(struct Command* cmnd, int* exitStatus) {
+	parallel(cmnd->args,exitStatus);
+}
+
+bool serveExit = false;
+
+void exitBuiltin(struct Command* cmnd, int* exitStatus) {
+	if(substituting) {
+		fflush(stdout);
+		if(eventFd != -1) {
+			eventFlush();
+		}
+		_exit(0);
+	}
+	if(serving) {
+		serveExit = true;
+		return;
+	}
+	historyFlush();
+	burnEverything();
+	cgroupCleanup();
+	if(eventFd != -1) {
+		eventFlush();
+	}
+	exit(0);
+}
+
+/* How routeCommand runs a builtin. Shell builtins act on the shell itself. A prefix runs the rest
+ * of the line, pipeline and all. A utility stands in for a program of the same name: it honors the
+ * line's redirects without forking, but anywhere it really has to be its own process, in a pipeline
+ * or the background, the program is run instead.
+ */
+enum BuiltinKind { BUILTIN_SHELL, BUILTIN_PREFIX, BUILTIN_UTILITY };
+
+struct Builtin {
+	const char* name;
+	void (*run)(struct Command* cmnd, int* exitStatus);
+	enum BuiltinKind kind;
+};
+
+//Sorted by name for bsearch. Adding a builtin is one entry here.
+const struct Builtin builtins[] = {
+	{ "[", testBuiltin, BUILTIN_UTILITY },
+	{ "bg", bgCommand, BUILTIN_SHELL },
+	{ "cd", cdBuiltin, BUILTIN_SHELL },
+	{ "echo", echoBuiltin, BUILTIN_UTILITY },
+	{ "exit", exitBuiltin, BUILTIN_SHELL },
+	{ "export", exportBuiltin, BUILTIN_SHELL },
+	{ "false", falseBuiltin, BUILTIN_UTILITY },
+	{ "fg", fgCommand, BUILTIN_SHELL },
+	{ "hash", hashBuiltin, BUILTIN_SHELL },
+	{ "history", historyBuiltin, BUILTIN_SHELL },
+	{ "jobs", jobsBuiltin, BUILTIN_SHELL },
+	{ "limit", limitCommand, BUILTIN_PREFIX },
+	{ "parallel", parallelBuiltin, BUILTIN_SHELL },
+	{ "parsecache", parseCacheBuiltin, BUILTIN_SHELL },
+	{ "printf", printfBuiltin, BUILTIN_UTILITY },
+	{ "pwd", pwdBuiltin, BUILTIN_UTILITY },
+	{ "status", statusBuiltin, BUILTIN_SHELL },
+	{ "test", testBuiltin, BUILTIN_UTILITY },
+	{ "time", timeCommand, BUILTIN_PREFIX },
+	{ "true", trueBuiltin, BUILTIN_UTILITY },
+	{ "unset", unsetBuiltin, BUILTIN_SHELL },
+	{ "wait", waitCommand, BUILTIN_SHELL },
+};
+
+int compareBuiltin(const void* name, const void* builtin) {
+	return strcmp(name,((const struct Builtin*)builtin)->name);
+}
+
+//The builtin called name, or NULL when it names a program.
+const struct Builtin* findBuiltin(const char* name) {
+	return bsearch(name,builtins,sizeof(builtins) / sizeof(builtins[0]),sizeof(builtins[0]),compareBuiltin);
+}
+
+//Route commands to either builtin function or fork and execute.
+void routeCommand(struct Command* cmnd, int* exitStatus) {
+	const struct Builtin* builtin = findBuiltin(cmnd->args[0]);
+	bool background = cmnd->backgroundProcess && allowBackground;
+	int saved[3];
+	//Execute smallsh builtins. Inside a pipeline every stage is run as a program, except for time.
+	if(builtin != NULL && (builtin->kind == BUILTIN_PREFIX ||
+			(cmnd->pipeNext == NULL && builtin->kind == BUILTIN_SHELL))) {
+		builtin->run(cmnd,exitStatus);
+	}
+	//utilities redirect the shell's own stdin and stdout around the call instead of forking.
+	else if(builtin != NULL && cmnd->pipeNext == NULL && !background) {
+		if(redirectApply(cmnd,saved)) {
+			builtin->run(cmnd,exitStatus);
+			redirectRestore(saved);
+		}
+		else {
+			*exitStatus = EXIT_FAILURE << 8;
+		}
+	}
+	else if(builtin == NULL && cmnd->pipeNext == NULL && assignVariables(cmnd)) {
+		*exitStatus = 0;
+	}
+	//Else route non-builtins to foreground or background mode exec.
+	else {
+		launchPipeline(cmnd,exitStatus);
+	}
+}
+
+/* Runs a line's commands one after another. Each is only parsed once the one before it is done, in
+ * the single pass the lexer makes over the line. '&&' runs the next command if the last status was
+ * success and '||' if it wasn't, with ';' running it either way; they bind equally and left to
+ * right, so a false && b || c skips b and runs c. A command killed by ^C stops the line, like sh,
+ * and so does a syntax error, which sets the status to 2.
+ */
+void runList(struct Command* cmnd, int* exitStatus) {
+	bool run = true;
+	while(1) {
+		parseSkipping = !run;
+		bool parsed = parseCommand(cmnd);
+		parseSkipping = false;
+		if(parsed && run) {
+			routeCommand(cmnd,exitStatus);
+			shellStatus = *exitStatus;
+		}
+		else if(cmnd->syntaxError) {
+			*exitStatus = 2 << 8;
+			shellStatus = *exitStatus;
+		}
+		if(cmnd->listRest == NULL || (WIFSIGNALED(*exitStatus) && WTERMSIG(*exitStatus) == SIGINT) || serveExit) {
+			return;
+		}
+		run = cmnd->listOp == LIST_SEQUENCE || (cmnd->listOp == LIST_AND) == (*exitStatus == 0);
+		char* rest = cmnd->listRest;
+		cmnd = newCommand();
+		cmnd->rawCommand = rest;
+	}
+}
+
+//Signals, child events and the MSHELL_* settings, for the shell loop and --serve alike.
+void shellInit(void) {
+	//handle signals.
+	sigintIgnore();
+	sigtstpSet();
+	childEventsSet();
+	cachePid();
+	historyWanted = interactive;
+	char* launch = getenv("MSHELL_LAUNCHER");
+	if(launch != NULL && strcmp(launch,"fork")==0) {
+		launcher = LAUNCH_FORK;
+	}
+	else if(launch != NULL && strcmp(launch,"zygote")==0) {
+		launcher = LAUNCH_ZYGOTE;
+	}
+	char* io = getenv("MSHELL_IO");
+	if(io != NULL && strcmp(io,"uring")==0) {
+		uringState = URING_WANTED;
+	}
+	char* parseCache = getenv("MSHELL_PARSE_CACHE");
+	if(parseCache != NULL && atoi(parseCache) > 0) {
+		parseCacheInit(atoi(parseCache));
+	}
+	//the trace fd is the shell's, not something to hand down to every command.
+	char* trace = getenv("MSHELL_TRACE_FD");
+	if(trace != NULL && fcntl(atoi(trace),F_SETFD,FD_CLOEXEC) != -1) {
+		traceFd = atoi(trace);
+	}
+	char* events = getenv("MSHELL_EVENT_FD");
+	if(events != NULL && fcntl(atoi(events),F_SETFD,FD_CLOEXEC) != -1) {
+		eventFd = atoi(events);
+		char* format = getenv("MSHELL_EVENT_FORMAT");
+		eventBinary = format != NULL && strcmp(format,"binary")==0;
+	}
+}
+
+void shell(void) {
+	int exitStatus = 0;
+	shellInit();
+
+	//start loop.
+	while(1) {
+		//allocate a Command struct from the arena, zeroed so the flags start out false.
+		struct Command* cmnd;
+		cmnd = newCommand();
+		
+		//scoop up a completed zombie process.
+		burnZombie();
+
+		//get user input. The end of it is an exit, with the last command's status.
+		if(!getCommand(cmnd)) {
+			historyFlush();
+			burnEverything();
+			cgroupCleanup();
+			if(eventFd != -1) {
+				eventFlush();
+			}
+			exit(exitCode(exitStatus));
+		}
+		
+		//parse the line's commands, then route and execute them.
+		runList(cmnd,&exitStatus);
+
+		//throw away everything the command allocated.
+		arenaReset();
+	}
+}
+
+/* mshell --serve socket: one long-lived shell runs command batches for any number of clients over a
+ * UNIX stream socket, so each request skips startup and finds the command hash, parse cache and
+ * environment already warm. Zygote helpers don't carry over: they're sent away after each batch,
+ * since they hold its directory and fds. A batch is a 4-byte big-endian length and that many bytes
+ * of lines, run the way a script's lines are. Up to three fds sent along with the length, by
+ * SCM_RIGHTS, stand in for stdin, stdout and stderr, in that order, for the batch; without them the
+ * server's own are used. For each line the client gets back "status N\n", N being the exit code,
+ * and after the last one "end N\n". Each connection has its own working directory and last status,
+ * swapped in for its batches; variables and jobs belong to the server, and with no one client to
+ * tell, finished background jobs go unreported. exit ends the connection. Batches run one at a
+ * time, so a client that goes quiet midway through sending one is dropped after a few seconds
+ * rather than holding up the rest.
+ */
+struct ServeClient
+{
+	int sock;
+	int cwd;			//O_PATH fd of its working directory.
+	int status;			//its last command's status, in waitpid() form.
+};
+struct ServeClient* serveClients = NULL;
+int numServeClients = 0;
+int serveListener = -1, serveHome = -1, serveStdio[3] = { -1, -1, -1 };
+
+void serveReply(struct ServeClient* client, const char* word, int status) {
+	char reply[32];
+	int length = snprintf(reply,sizeof(reply),"%s %d\n",word,exitCode(status));
+	send(client->sock,reply,length,MSG_NOSIGNAL);
+}
+
+/* Reads one batch from a client and runs it in the client's directory with its fds. Returns false
+ * when the client is finished with: it hung up, sent something malformed, or ran exit.
+ */
+bool serveBatch(struct ServeClient* client, int stdio[3]) {
+	uint32_t length;
+	int fds[3], numFds = 0;
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	struct iovec part = { &length, sizeof(length) };
+	struct msghdr msg = { .msg_iov = &part, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+	ssize_t got = recvmsg(client->sock,&msg,MSG_CMSG_CLOEXEC|MSG_WAITALL);
+	for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg,cmsg)) {
+		if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds,CMSG_DATA(cmsg),numFds * sizeof(int));
+		}
+	}
+	length = ntohl(length);
+	if(got != sizeof(length) || length > SERVE_MAX_BATCH) {
+		for(int i=0; i<numFds; i++) {
+			close(fds[i]);
+		}
+		return false;
+	}
+	//the batch becomes the input buffer, the same as a -c string.
+	free(inputBuffer);
+	inputSize = length + 2;
+	inputBuffer = xmalloc(inputSize);
+	bool whole = length == 0 || recv(client->sock,inputBuffer,length,MSG_WAITALL) == (ssize_t)length;
+	inputBuffer[length] = '\n';
+	inputStart = 0;
+	inputEnd = whole ? length + 1 : 0;
+
+	for(int i=0; i<numFds; i++) {
+		dup2(fds[i],i);
+		close(fds[i]);
+	}
+	if(fchdir(client->cwd) == -1) {
+		perror("smallsh: --serve");
+		fflush(stderr);
+	}
+	shellStatus = client->status;
+	while(whole && !serveExit) {
+		struct Command* cmnd = newCommand();
+		burnZombie();
+		if(!getCommand(cmnd)) {
+			break;
+		}
+		runList(cmnd,&client->status);
+		fflush(stdout);
+		fflush(stderr);
+		serveReply(client,"status",client->status);
+		arenaReset();
+	}
+	if(eventFd != -1) {
+		eventFlush();
+	}
+	fflush(stdout);
+	fflush(stderr);
+	//helpers forked during the batch have this client's directory and fds, so they go with it.
+	zygoteDrain();
+	for(int i=0; i<numFds; i++) {
+		dup2(stdio[i],i);
+	}
+	//cd moved the shell; that new directory is the client's from now on.
+	int cwd = open(".",O_PATH|O_DIRECTORY|O_CLOEXEC);
+	if(cwd != -1) {
+		close(client->cwd);
+		client->cwd = cwd;
+	}
+	if(whole) {
+		serveReply(client,"end",client->status);
+	}
+	bool keep = whole && !serveExit;
+	serveExit = false;
+	return keep;
+}
+
+void serve(char* path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr,"smallsh: --serve: socket path too long.\n");
+		exit(2);
+	}
+	strcpy(addr.sun_path,path);
+	//a socket left behind by a server that's gone would make bind fail; nothing else is removed.
+	if(lstat(path,&st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	serveListener = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+	if(serveListener == -1 || bind(serveListener,(struct sockaddr*)&addr,sizeof(addr)) == -1 || listen(serveListener,SOMAXCONN) == -1) {
+		fprintf(stderr,"smallsh: --serve %s: %s.\n",path,strerror(errno));
+		exit(1);
+	}
+	interactive = false;
+	inputFd = -1;
+	serving = true;
+	shellInit();
+	serveHome = open(".",O_PATH|O_DIRECTORY|O_CLOEXEC);
+	for(int i=0; i<3; i++) {
+		serveStdio[i] = fcntl(i,F_DUPFD_CLOEXEC,3);
+	}
+	struct pollfd* events = xmalloc(2 * sizeof(struct pollfd));
+	int clientsSize = 0;
+	while(1) {
+		events[0] = (struct pollfd){ serveListener, POLLIN, 0 };
+		events[1] = (struct pollfd){ childEventFd, POLLIN, 0 };
+		for(int i=0; i<numServeClients; i++) {
+			events[i + 2] = (struct pollfd){ serveClients[i].sock, POLLIN, 0 };
+		}
+		if(eventFd != -1) {
+			eventFlush();
+		}
+		if(poll(events,numServeClients + 2,-1) == -1) {
+			continue;
+		}
+		if(events[1].revents & POLLIN) {
+			reapChildren();
+		}
+		//clients leave from the back, so the ones still to look at keep their places.
+		for(int i=numServeClients - 1; i>=0; i--) {
+			if(events[i + 2].revents && !serveBatch(&serveClients[i],serveStdio)) {
+				close(serveClients[i].sock);
+				close(serveClients[i].cwd);
+				serveClients[i] = serveClients[--numServeClients];
+			}
+		}
+		if(events[0].revents & POLLIN) {
+			int sock = accept4(serveListener,NULL,NULL,SOCK_CLOEXEC);
+			if(sock != -1) {
+				struct timeval timeout = { 5, 0 };
+				setsockopt(sock,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+				if(numServeClients == clientsSize) {
+					clientsSize = clientsSize ? clientsSize * 2 : 8;
+					struct ServeClient* grown = xmalloc(clientsSize * sizeof(struct ServeClient));
+					memcpy(grown,serveClients,numServeClients * sizeof(struct ServeClient));
+					free(serveClients);
+					serveClients = grown;
+					free(events);
+					events = xmalloc((clientsSize + 2) * sizeof(struct pollfd));
+				}
+				serveClients[numServeClients++] = (struct ServeClient){ sock, fcntl(serveHome,F_DUPFD_CLOEXEC,3), 0 };
+			}
+		}
+		burnZombie();
+		arenaReset();
+	}
+}
+
+/* For forked copies of the shell that carry on without exec'ing, $(...) and tee stages: closes the
+ * fds only the shell itself should hold. Those are the zygote sockets, the io_uring ring, the
+ * history file and, under --serve, the listener and every client's socket and directory.
+ */
+void forkedCopyClose() {
+	zygoteDrain();
+	if(uringState == URING_READY) {
+		close(uring.fd);
+		uringState = URING_WANTED;
+	}
+	if(historyFd != -1) {
+		close(historyFd);
+		historyFd = -1;
+	}
+	for(int i=0; i<numServeClients; i++) {
+		close(serveClients[i].sock);
+		close(serveClients[i].cwd);
+	}
+	numServeClients = 0;
+	int* serveFds[] = { &serveListener, &serveHome, &serveStdio[0], &serveStdio[1], &serveStdio[2] };
+	for(int i=0; i<5; i++) {
+		if(*serveFds[i] != -1) {
+			close(*serveFds[i]);
+			*serveFds[i] = -1;
+		}
+	}
+}
+
+/* MSHELL_NO_MAIN lets the bench programs include this file and drive its pieces directly.
+ * usage: mshell [script | -c command | --serve socket]
+ */
+#ifndef MSHELL_NO_MAIN
+int main(int argc, char* argv[]) 
+{
+	if(argc > 1 && strcmp(argv[1],"-c")==0) {
+		if(argc < 3) {
+			fprintf(stderr,"smallsh: -c needs a command.\n");
+			return 2;
+		}
+		inputSet(NULL,argv[2]);
+	}
+	else if(argc > 1 && strcmp(argv[1],"--serve")==0) {
+		if(argc < 3) {
+			fprintf(stderr,"smallsh: --serve needs a socket path.\n");
+			return 2;
+		}
+		serve(argv[2]);
+	}
+	else {
+		inputSet(argc > 1 ? argv[1] : NULL,NULL);
+	}
 	shell();
 	return 0;
 }
+#endif